@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "arena.h"
+
+#define ARENA_ALIGN       (16)
+#define ARENA_ROUND(n)    (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define ARENA_HDR         ARENA_ROUND(sizeof(arena_chunk_t))
+
+static arena_chunk_t* arena_chunk(size_t size){
+  arena_chunk_t* chunk;
+
+  chunk = (arena_chunk_t*) malloc(ARENA_HDR + size);
+  if(chunk == NULL){
+    fprintf(stderr, "Error: out of memory in arena_alloc.\n");
+    exit(EXIT_FAILURE);
+  }
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+
+  return chunk;
+}
+
+void arena_init(arena_t* this, size_t chunksize){
+  this->first = NULL;
+  this->cur = NULL;
+  this->big = NULL;
+  this->chunksize = ARENA_ROUND(chunksize);
+}
+
+void* arena_alloc(arena_t* this, size_t size){
+  arena_chunk_t* chunk;
+  void* ans;
+
+  size = ARENA_ROUND(size ? size : 1);
+
+  /* Anything over a quarter chunk gets its own allocation */
+  if(size > this->chunksize / 4){
+    chunk = arena_chunk(size);
+    chunk->next = this->big;
+    this->big = chunk;
+    return (char*) chunk + ARENA_HDR;
+  }
+
+  if(this->cur == NULL){
+    this->first = this->cur = arena_chunk(this->chunksize);
+  }
+
+  /* Move on to the next kept chunk, or add one, when this one is full */
+  while(this->cur->used + size > this->cur->size){
+    if(this->cur->next == NULL)
+      this->cur->next = arena_chunk(this->chunksize);
+    this->cur = this->cur->next;
+    this->cur->used = 0;
+  }
+
+  ans = (char*) this->cur + ARENA_HDR + this->cur->used;
+  this->cur->used += size;
+
+  return ans;
+}
+
+void arena_mark(arena_t* this, arena_mark_t* mark){
+  mark->cur = this->cur;
+  mark->used = this->cur != NULL ? this->cur->used : 0;
+  mark->big = this->big;
+}
+
+void arena_release(arena_t* this, const arena_mark_t* mark){
+  arena_chunk_t* chunk;
+
+  while(this->big != mark->big){
+    chunk = this->big;
+    this->big = chunk->next;
+    free(chunk);
+  }
+
+  /* Chunks past the marked one are emptied when alloc moves on to them */
+  this->cur = mark->cur != NULL ? mark->cur : this->first;
+  if(this->cur != NULL)
+    this->cur->used = mark->used;
+}
+
+void arena_reset(arena_t* this){
+  arena_chunk_t* chunk;
+
+  while(this->big != NULL){
+    chunk = this->big;
+    this->big = chunk->next;
+    free(chunk);
+  }
+
+  this->cur = this->first;
+  if(this->cur != NULL)
+    this->cur->used = 0;
+}
+
+void arena_destroy(arena_t* this){
+  arena_chunk_t* chunk;
+
+  arena_reset(this);
+  while(this->first != NULL){
+    chunk = this->first;
+    this->first = chunk->next;
+    free(chunk);
+  }
+  this->cur = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator. Allocations are carved out of large chunks and
+ * are never freed individually; arena_reset releases everything at
+ * once but keeps the chunks, so a reused arena stops calling malloc
+ * once it has grown to its working size.
+ */
+
+typedef struct arena_chunk_t{
+  struct arena_chunk_t* next;
+  size_t size;
+  size_t used;
+} arena_chunk_t;
+
+typedef struct{
+  arena_chunk_t* first;   /*Chunks kept across resets*/
+  arena_chunk_t* cur;     /*Chunk currently being carved up*/
+  arena_chunk_t* big;     /*Oversized allocations, freed on reset*/
+  size_t chunksize;
+} arena_t;
+
+/* Initializes the arena; chunks are chunksize bytes */
+void arena_init(arena_t* this, size_t chunksize);
+
+/* Returns size bytes, aligned for any type. Exits if out of memory */
+void* arena_alloc(arena_t* this, size_t size);
+
+/* A position in an arena, see arena_mark */
+typedef struct{
+  arena_chunk_t* cur;
+  size_t used;
+  arena_chunk_t* big;
+} arena_mark_t;
+
+/* Records the current position, for arena_release */
+void arena_mark(arena_t* this, arena_mark_t* mark);
+
+/* Releases every allocation made since mark was taken */
+void arena_release(arena_t* this, const arena_mark_t* mark);
+
+/* Releases every allocation at once */
+void arena_reset(arena_t* this);
+
+/* Frees all memory associated with this */
+void arena_destroy(arena_t* this);
+
+#endif
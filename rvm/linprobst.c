@@ -0,0 +1,147 @@
+#include<stdlib.h>
+#include<stdint.h>
+#include"linprobst.h"
+
+#define LINPROBST_INIT_M (16)
+
+static int linprobst_slot(linprobst_t* st, linprobst_key key){
+  return (int) (st->hash(key) & (unsigned long) (st->M - 1));
+}
+
+static void linprobst_resize(linprobst_t* st, int M){
+  linprobst_key* keys;
+  linprobst_value* values;
+  int i, oldM;
+
+  keys = st->keys;
+  values = st->values;
+  oldM = st->M;
+
+  st->keys = (linprobst_key*) calloc(M, sizeof(linprobst_key));
+  st->values = (linprobst_value*) calloc(M, sizeof(linprobst_value));
+  st->M = M;
+  st->N = 0;
+
+  for(i = 0; i < oldM; i++)
+    if(keys[i] != NULL)
+      linprobst_put(st, keys[i], values[i]);
+
+  free(keys);
+  free(values);
+}
+
+void linprobst_init(linprobst_t* st, unsigned long (*hash)(linprobst_key key),
+                    int (*keyeq)(linprobst_key a, linprobst_key b)){
+  st->M = LINPROBST_INIT_M;
+  st->N = 0;
+  st->keys = (linprobst_key*) calloc(st->M, sizeof(linprobst_key));
+  st->values = (linprobst_value*) calloc(st->M, sizeof(linprobst_value));
+  st->hash = hash;
+  st->keyeq = keyeq;
+}
+
+int linprobst_size(linprobst_t* st){
+  return st->N;
+}
+
+int linprobst_isempty(linprobst_t* st){
+  return st->N == 0;
+}
+
+int linprobst_contains(linprobst_t* st, linprobst_key key){
+  return linprobst_get(st, key) != NULL;
+}
+
+linprobst_value linprobst_get(linprobst_t* st, linprobst_key key){
+  int i;
+
+  for(i = linprobst_slot(st, key); st->keys[i] != NULL; i = (i + 1) & (st->M - 1))
+    if(st->keyeq(st->keys[i], key))
+      return st->values[i];
+
+  return NULL;
+}
+
+void linprobst_put(linprobst_t* st, linprobst_key key, linprobst_value value){
+  int i;
+
+  if(2 * (st->N + 1) > st->M)
+    linprobst_resize(st, 2 * st->M);
+
+  for(i = linprobst_slot(st, key); st->keys[i] != NULL; i = (i + 1) & (st->M - 1)){
+    if(st->keyeq(st->keys[i], key)){
+      st->values[i] = value;
+      return;
+    }
+  }
+
+  st->keys[i] = key;
+  st->values[i] = value;
+  st->N++;
+}
+
+linprobst_value linprobst_delete(linprobst_t* st, linprobst_key key){
+  linprobst_value ans;
+  linprobst_key rekey;
+  linprobst_value revalue;
+  int i;
+
+  for(i = linprobst_slot(st, key); st->keys[i] != NULL; i = (i + 1) & (st->M - 1))
+    if(st->keyeq(st->keys[i], key))
+      break;
+
+  if(st->keys[i] == NULL)
+    return NULL;
+
+  ans = st->values[i];
+  st->keys[i] = NULL;
+  st->values[i] = NULL;
+  st->N--;
+
+  /* Reinsert the rest of the cluster so probes still find it */
+  for(i = (i + 1) & (st->M - 1); st->keys[i] != NULL; i = (i + 1) & (st->M - 1)){
+    rekey = st->keys[i];
+    revalue = st->values[i];
+    st->keys[i] = NULL;
+    st->values[i] = NULL;
+    st->N--;
+    linprobst_put(st, rekey, revalue);
+  }
+
+  return ans;
+}
+
+void linprobst_destroy(linprobst_t *st){
+  free(st->keys);
+  free(st->values);
+  st->keys = NULL;
+  st->values = NULL;
+  st->M = 0;
+  st->N = 0;
+}
+
+/* FNV-1a over a NUL terminated string */
+unsigned long linprobst_strhash(linprobst_key key){
+  const unsigned char* p;
+  uint64_t h;
+
+  h = 14695981039346656037ULL;
+  for(p = (const unsigned char*) key; *p != '\0'; p++){
+    h ^= *p;
+    h *= 1099511628211ULL;
+  }
+
+  return (unsigned long) h;
+}
+
+/* Pointers are aligned, so mix the high bits down before masking */
+unsigned long linprobst_ptrhash(linprobst_key key){
+  uint64_t h;
+
+  h = (uint64_t) (uintptr_t) key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return (unsigned long) h;
+}
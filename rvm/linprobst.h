@@ -0,0 +1,35 @@
+#ifndef LINPROBST_H
+#define LINPROBST_H
+
+/*
+ * Linear probing hash symbol table. Same interface as seqsrchst, but
+ * the caller also supplies the hash function. The table doubles when
+ * it becomes half full, so lookups stay O(1) on average.
+ */
+
+typedef void* linprobst_key;
+typedef void* linprobst_value;
+
+typedef struct{
+  linprobst_key* keys;
+  linprobst_value* values;
+  int M;
+  int N;
+  unsigned long (*hash)(linprobst_key key);
+  int (*keyeq)(linprobst_key a, linprobst_key b);
+}linprobst_t;
+
+void linprobst_init(linprobst_t* st, unsigned long (*hash)(linprobst_key key),
+                    int (*keyeq)(linprobst_key a, linprobst_key b));
+int linprobst_size(linprobst_t* st);
+int linprobst_isempty(linprobst_t* st);
+int linprobst_contains(linprobst_t* st, linprobst_key key);
+linprobst_value linprobst_get(linprobst_t* st, linprobst_key key);
+linprobst_value linprobst_delete(linprobst_t* st, linprobst_key key);
+void linprobst_put(linprobst_t* st, linprobst_key key, linprobst_value value);
+void linprobst_destroy(linprobst_t *st);
+
+/* Hash functions for the two kinds of keys rvm uses */
+unsigned long linprobst_strhash(linprobst_key key);
+unsigned long linprobst_ptrhash(linprobst_key key);
+#endif
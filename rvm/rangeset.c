@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "rangeset.h"
+
+void rangeset_init(rangeset_t* this){
+  this->ranges = NULL;
+  this->N = 0;
+  this->cap = 0;
+}
+
+/* Index of the first range that ends at or after offset */
+static int rangeset_lower(rangeset_t* this, size_t offset){
+  int lo = 0, hi = this->N, mid;
+
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(this->ranges[mid].offset + this->ranges[mid].size < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+void rangeset_add(rangeset_t* this, size_t offset, size_t size, rangeset_gap_fn gap, void* arg){
+  int i, j;
+  size_t lo, hi, end, cursor;
+  range_t* r;
+
+  if(size == 0)
+    return;
+
+  lo = offset;
+  hi = offset + size;
+
+  /* Ranges i..j-1 overlap or touch [lo, hi) and are folded into it */
+  i = rangeset_lower(this, lo);
+  cursor = lo;
+  for(j = i; j < this->N && this->ranges[j].offset <= hi; j++){
+    r = &(this->ranges[j]);
+    if(gap != NULL && r->offset > cursor)
+      gap(arg, cursor, (r->offset < hi ? r->offset : hi) - cursor);
+    end = r->offset + r->size;
+    if(end > cursor)
+      cursor = end;
+  }
+  if(gap != NULL && cursor < hi)
+    gap(arg, cursor, hi - cursor);
+
+  if(j > i){
+    if(this->ranges[i].offset < lo)
+      lo = this->ranges[i].offset;
+    end = this->ranges[j - 1].offset + this->ranges[j - 1].size;
+    if(end > hi)
+      hi = end;
+
+    /* Keep slot i for the merged range, close up the rest */
+    memmove(&(this->ranges[i + 1]), &(this->ranges[j]), (this->N - j) * sizeof(range_t));
+    this->N -= j - i - 1;
+  }
+  else{
+    if(this->N == this->cap){
+      this->cap = this->cap ? 2 * this->cap : 8;
+      this->ranges = (range_t*) realloc(this->ranges, this->cap * sizeof(range_t));
+      if(this->ranges == NULL){
+        fprintf(stderr, "Error: out of memory in rangeset_add.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    memmove(&(this->ranges[i + 1]), &(this->ranges[i]), (this->N - i) * sizeof(range_t));
+    this->N++;
+  }
+
+  this->ranges[i].offset = lo;
+  this->ranges[i].size = hi - lo;
+}
+
+void rangeset_reserve(rangeset_t* this, int n){
+  if(this->N + n <= this->cap)
+    return;
+
+  this->cap = this->N + n;
+  this->ranges = (range_t*) realloc(this->ranges, this->cap * sizeof(range_t));
+  if(this->ranges == NULL){
+    fprintf(stderr, "Error: out of memory in rangeset_reserve.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void rangeset_clear(rangeset_t* this){
+  this->N = 0;
+}
+
+void rangeset_destroy(rangeset_t* this){
+  free(this->ranges);
+  rangeset_init(this);
+}
@@ -0,0 +1,44 @@
+#ifndef RANGESET_H
+#define RANGESET_H
+
+/*
+ * A set of byte ranges kept as a sorted array of disjoint intervals.
+ * Overlapping and adjacent ranges are merged as they are added.
+ */
+
+#include <stddef.h>
+
+typedef struct{
+  size_t offset;
+  size_t size;
+} range_t;
+
+typedef struct{
+  range_t* ranges;
+  int N;
+  int cap;
+} rangeset_t;
+
+/* Called for each part of an added range that was not yet in the set */
+typedef void (*rangeset_gap_fn)(void* arg, size_t offset, size_t size);
+
+/* Initializes the data structure */
+void rangeset_init(rangeset_t* this);
+
+/*
+ * Adds [offset, offset + size) to the set. If gap is not NULL it is
+ * called, in ascending order, for every sub-range that was not
+ * already covered.
+ */
+void rangeset_add(rangeset_t* this, size_t offset, size_t size, rangeset_gap_fn gap, void* arg);
+
+/* Makes room for n more ranges, so the next n adds do not allocate */
+void rangeset_reserve(rangeset_t* this, int n);
+
+/* Empties the set, keeping its memory for reuse */
+void rangeset_clear(rangeset_t* this);
+
+/* Frees memory associated with this */
+void rangeset_destroy(rangeset_t* this);
+
+#endif
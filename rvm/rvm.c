@@ -1,485 +1,3499 @@
+#define _GNU_SOURCE
 #include"rvm.h"
+#include"rvm_log.h"
+#include"rvm_fault.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 /* Mostly arbitrary constants, extracted from hardcoded vals in rvm.h */
 #define PATH_BUF_SIZE       (128)
 #define SEGNAME_SIZE        (128)
-#define REDO_PATH_BUF_SIZE  (PATH_BUF_SIZE + 16)
-
-static seqsrchst_t *segments;
-static redo_t redolog;
-
-int segname_keyeq(seqsrchst_key a, seqsrchst_key b) {
+#define REDO_PATH_BUF_SIZE  (PATH_BUF_SIZE + 32)
+#define TRANS_ARENA_CHUNK   (64 * 1024)
+#define TRANS_REDO_INIT     (64 * 1024)
+#define TRANS_REDO_KEEP     (16 << 20)
+#define TRUNCATE_STEP       (8 << 20)
+#define LOG_HOLE_ALIGN      (4096)
+#define WRITEBACK_PLAN_MAX  (64 << 20)
+#define WRITEBACK_IOV_MAX   (64)
+#define SEGFD_CACHE_MAX     (64)
+#define APPLY_WORKERS_MAX   (8)
+#define MODIFY_V_STACK      (64)
+#define TRACK_CHUNK_PAGES   (16)
+
+/* Recovery states of a page of a lazily mapped segment */
+#define LAZY_PENDING        (0)
+#define LAZY_APPLYING       (1)
+#define LAZY_DONE           (2)
+
+int segname_keyeq(linprobst_key a, linprobst_key b) {
   return (strcmp((char *) a, (char *) b) == 0);
 }
 
-int segbase_keyeq(seqsrchst_key a, seqsrchst_key b) {
+int segbase_keyeq(linprobst_key a, linprobst_key b) {
   return (((void *) a) == (void *) b);
 }
 
-static void get_file_path(rvm_t rvm, const char *segname, char *path) {
-  strncpy(path, rvm->prefix, PATH_BUF_SIZE);
-  strcat(path, "/");
-  strncat(path, segname, SEGNAME_SIZE);
+/*
+  Index of the first mapped segment whose base is above ptr.
+*/
+static int segidx_upper(const rvm_segidx_t *idx, void *ptr) {
+  int lo = 0, hi = idx != NULL ? idx->n : 0, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if ((char *) idx->segs[mid]->segbase <= (char *) ptr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* The segment in idx containing ptr, or NULL */
+static segment_t segidx_find(const rvm_segidx_t *idx, void *ptr) {
+  segment_t seg;
+  int i;
+
+  i = segidx_upper(idx, ptr) - 1;
+  if (i < 0)
+    return NULL;
+
+  seg = idx->segs[i];
+  if ((char *) ptr < (char *) seg->segbase + seg->size)
+    return seg;
+
+  return NULL;
 }
 
 /*
-  Initialize the library with the specified directory as backing store.
+  Swaps in a new index, then frees the old one once no fault handler
+  can still be searching it. A handler counts itself in before it
+  loads the pointer, so one the count misses sees the new index.
+  Called with the map lock held exclusively.
 */
-rvm_t rvm_init(const char *directory){
-  char redopath[REDO_PATH_BUF_SIZE];
-  FILE *f;
-  struct stat st = {0};
-  rvm_t rvm;
+static void segidx_publish(rvm_t rvm, rvm_segidx_t *idx) {
+  rvm_segidx_t *old = rvm->segidx;
+
+  __sync_synchronize();
+  rvm->segidx = idx;
+  __sync_synchronize();
+  while (*(volatile int *) &(rvm->segidx_readers) > 0)
+    sched_yield();
+  free(old);
+}
 
-  rvm = malloc(sizeof(*rvm));
-  segments = malloc(sizeof(*segments));
+static rvm_segidx_t *segidx_alloc(int n) {
+  rvm_segidx_t *idx;
 
-  /* Only make the directory if it does not exist */
-  if (stat(directory, &st) == -1) {
-    mkdir(directory, 0744);
+  if ((idx = malloc(sizeof(*idx) + n * sizeof(segment_t))) == NULL) {
+    fprintf(stderr, "Error: out of memory in rvm segment index.\n");
+    exit(EXIT_FAILURE);
   }
+  idx->n = n;
 
-  strncpy(rvm->prefix, directory, (PATH_BUF_SIZE - 1));
+  return idx;
+}
 
-  /* Initialize data structures too */
-  seqsrchst_init(segments, segname_keyeq);
-  seqsrchst_init(&(rvm->segst), segbase_keyeq);
+/*
+  Record a freshly mapped segment under its base pointer.
+*/
+static void add_mapping(rvm_t rvm, segment_t seg) {
+  rvm_segidx_t *old = rvm->segidx, *idx;
+  int i, n = old != NULL ? old->n : 0;
+
+  idx = segidx_alloc(n + 1);
+  i = segidx_upper(old, seg->segbase);
+  if (old != NULL) {
+    memcpy(&(idx->segs[0]), &(old->segs[0]), i * sizeof(segment_t));
+    memcpy(&(idx->segs[i + 1]), &(old->segs[i]), (n - i) * sizeof(segment_t));
+  }
+  idx->segs[i] = seg;
+  segidx_publish(rvm, idx);
 
-  /* Create redo log file */
-  strcpy(redopath, rvm->prefix);
-  strcat(redopath, "/redo.log");
-  f = fopen(redopath, "a+");
-  fclose(f);
-  redolog = malloc(sizeof(*redolog));
+  linprobst_put(&(rvm->segst), (linprobst_key) seg->segbase, (linprobst_value) seg);
+}
 
-  return rvm;
+static void drop_mapping(rvm_t rvm, segment_t seg) {
+  rvm_segidx_t *old = rvm->segidx, *idx;
+  int i;
+
+  linprobst_delete(&(rvm->segst), (linprobst_key) seg->segbase);
+
+  i = segidx_upper(old, seg->segbase) - 1;
+  if (i >= 0 && old->segs[i] == seg) {
+    idx = segidx_alloc(old->n - 1);
+    memcpy(&(idx->segs[0]), &(old->segs[0]), i * sizeof(segment_t));
+    memcpy(&(idx->segs[i]), &(old->segs[i + 1]), (old->n - i - 1) * sizeof(segment_t));
+    segidx_publish(rvm, idx);
+  }
 }
 
 /*
-  map a segment from disk into memory. If the segment does not already exist, then create it and give it size size_to_create. If the segment exists but is shorter than size_to_create, then extend it until it is long enough. It is an error to try to map the same segment twice.
+  Find the mapped segment containing ptr, which may point anywhere
+  inside it. Base pointers hit the hash table; interior pointers fall
+  back to a binary search of the sorted index. Called with the map
+  lock held.
 */
-void *rvm_map(rvm_t rvm, const char *segname, int size_to_create){
-  char path[PATH_BUF_SIZE + 1 + SEGNAME_SIZE];
+static segment_t find_mapping(rvm_t rvm, void *ptr) {
   segment_t seg;
-  FILE *f;
-  int oldsize, sizediff = -1;
-  char *data;
 
-  /* Do lazy log truncation */
-  rvm_truncate_log(rvm);
+  if ((seg = (segment_t) linprobst_get(&(rvm->segst), (linprobst_key) ptr)) != NULL)
+    return seg;
 
-  /* Get file path for segment */
-  get_file_path(rvm, segname, path);
+  return segidx_find(rvm->segidx, ptr);
+}
 
-  /* Check if segment exists by name */
-  if (seqsrchst_contains(segments, (seqsrchst_key) segname)) {
-    seg = (segment_t) seqsrchst_get(segments, (seqsrchst_key) segname);
+/*
+  find_mapping for fault handlers, which must not take the map lock:
+  the thread that faulted may hold it. Signal safe.
+*/
+static segment_t fault_mapping(rvm_t rvm, void *ptr) {
+  segment_t seg;
 
-    /* If we are remapping an existing mapped memory location, we need to bail */
-    if (seqsrchst_contains(&(rvm->segst), (seqsrchst_key) seg->segbase)) {
-      printf("Remapping existing mem segment, bailing...\n");
-      fflush(stdout);
-      return (void *) -1;
-    }
+  __sync_fetch_and_add(&(rvm->segidx_readers), 1);
+  seg = segidx_find(*(rvm_segidx_t * volatile *) &(rvm->segidx), ptr);
+  __sync_fetch_and_sub(&(rvm->segidx_readers), 1);
 
-    /* Check if the segment size is too small */
-    if (seg->size < size_to_create) {
+  return seg;
+}
 
-      /* Realloc */
-      if ((seg->segbase = realloc(seg->segbase, size_to_create)) == NULL) {
-        /* We failed, so return error */
-        printf("Failed to realloc, bailing...\n");
-        fflush(stdout);
-        return (void *) -1;
-      }
+static void get_file_path(rvm_t rvm, const char *segname, char *path) {
+  strncpy(path, rvm->prefix, PATH_BUF_SIZE);
+  strcat(path, "/");
+  strncat(path, segname, SEGNAME_SIZE);
+}
 
-      oldsize = seg->size;
-      sizediff = size_to_create - oldsize;
-      seg->size = size_to_create;
+/*
+  Writes all of buf to fd at offset, retrying short writes.
+*/
+static int pwrite_all(int fd, const char *buf, size_t len, off_t offset) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = pwrite(fd, buf, len, offset);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
     }
-  } else {
-    /* Come here if the segment doesn't exist yet */
-    seg = malloc(sizeof(*seg));
-    strncpy(seg->segname, segname, SEGNAME_SIZE-1);
-    seg->size = size_to_create;
-    seg->cur_trans = (trans_t) -1;
-    steque_init(&(seg->mods));
+    buf += n;
+    len -= (size_t) n;
+    offset += n;
+  }
 
-    /* If no, malloc memory, create log file, and put into data struct */
-    if ((seg->segbase = malloc(size_to_create)) == NULL) {
-      /* We failed, so return error */
-      printf("Failed to malloc, bailing...\n");
-      fflush(stdout);
-      return (void *) -1;
-    } 
+  return 0;
+}
 
-    seqsrchst_put(segments, (seqsrchst_key) seg->segname, (seqsrchst_value) seg);
-  }
+/*
+  Builds the path of log shard i. The first shard is the log rvm always
+  had, so a single log looks the same as before shards.
+*/
+static void shard_path(rvm_t rvm, int i, char *path) {
+  strcpy(path, rvm->prefix);
+  strcat(path, "/redo.log");
+  if (i > 0)
+    sprintf(path + strlen(path), ".%d", i);
+}
+
+/*
+  Shard whose log holds the records of segname. The string hash barely
+  mixes the last characters of a name, so names that differ only there
+  (seg0, seg1, ...) would share a shard; mix it once more.
+*/
+static int shard_of(rvm_t rvm, const char *segname) {
+  uint64_t h = (uint64_t) linprobst_strhash((linprobst_key) segname);
 
-  seqsrchst_put(&(rvm->segst), (seqsrchst_key) seg->segbase, (seqsrchst_value) seg->segname);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
 
-  /* This should read in a segment file's contents if the file exists */
-  if(access(path, F_OK) != -1) {
+  return (int) (h % (uint64_t) rvm->nshards);
+}
+
+/* Adds the time since start, from rvm_trace_now, to one of the timers of rvm_stats */
+static void stats_time(uint64_t *timer, uint64_t start) {
+  uint64_t now = rvm_trace_now();
 
-    /* Need to set memory in the realloc case */
-    if (sizediff > 0) {
-      data = (char *) seg->segbase;
+  if (now > start)
+    __sync_fetch_and_add(timer, now - start);
+}
 
-      f = fopen(path, "a+");
-      memset(&(data[oldsize]), 0, sizediff);
-      fwrite(&(data[oldsize]), sizeof(char), sizediff, f);
-      fclose(f);
+/*
+  Makes the log durable up to at least end. Whoever finds no sync in
+  progress runs one for every byte written so far; the others wait for
+  it, so concurrent committers share fdatasync calls. Offsets from an
+  earlier epoch are done with: the log was only emptied or replaced
+  once everything in it was durable. Called with the log lock held.
+*/
+static int log_sync(rvm_t rvm, rvm_shard_t *sh, uint64_t end, uint64_t epoch) {
+  uint64_t target, t;
+  int ret = 0;
+
+  while (sh->logepoch == epoch && sh->logsynced < end) {
+    if (sh->logsyncing) {
+      pthread_cond_wait(&(sh->logcond), &(sh->loglock));
+      continue;
     }
 
-    f = fopen(path, "r");
-    fread(seg->segbase, sizeof(char), seg->size, f);
-    fclose(f);
-  } else {
-    f = fopen(path, "a+");
-    memset(seg->segbase, 0, seg->size);
-    fwrite(seg->segbase, sizeof(char), seg->size, f);
-    fclose(f);
+    sh->logsyncing = 1;
+    target = sh->logdone;
+    pthread_mutex_unlock(&(sh->loglock));
+    t = rvm_trace_now();
+    ret = fdatasync(sh->redofd);
+    stats_time(&(rvm->stats.log_sync_ns), t);
+    __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+    rvm_trace_add(&(rvm->trace), RVM_TRACE_LOG_SYNC, t, (uint64_t) (sh - rvm->shards));
+    pthread_mutex_lock(&(sh->loglock));
+    sh->logsyncing = 0;
+    if (ret == 0 && sh->logepoch == epoch && target > sh->logsynced)
+      sh->logsynced = target;
+    pthread_cond_broadcast(&(sh->logcond));
+    if (ret != 0)
+      break;
   }
 
-  return seg->segbase;
+  return ret;
+}
+
+/* Has the background truncator look at the logs' backlog */
+static void truncator_wake(rvm_t rvm) {
+  pthread_mutex_lock(&(rvm->trunc.wakelock));
+  pthread_cond_signal(&(rvm->trunc.wake));
+  pthread_mutex_unlock(&(rvm->trunc.wakelock));
 }
 
 /*
-  unmap a segment from memory.
+  Appends buf to a log and pushes it as far as the durability level
+  asks. The space is reserved under the log lock, but the write itself
+  runs outside it, so appends from several threads proceed in
+  parallel. An append only counts as done once everything before it
+  is written too, or recovery could stop short of it at a hole. For
+  the same reason, once a write fails every append past it fails too:
+  logdone never moves beyond the hole, and the log stays that way
+  until rvm is restarted and cuts it off there.
 */
-void rvm_unmap(rvm_t rvm, void *segbase){
-  if (seqsrchst_contains(&(rvm->segst), (seqsrchst_key) segbase)) {
-    seqsrchst_delete(&(rvm->segst), (seqsrchst_key) segbase);
+static int log_append(rvm_t rvm, rvm_shard_t *sh, const char *buf, size_t len) {
+  uint64_t start, done, epoch, t;
+  int ret = 0, wake;
+
+  __sync_fetch_and_add(&(rvm->stats.log_writes), 1);
+  pthread_mutex_lock(&(sh->loglock));
+
+  /*
+   * Without durability the records only go to the stdio buffer, which
+   * reaches the file whenever it fills; logend counts them anyway, so
+   * the log is never taken for caught up while some are in flight.
+   * See log_drain.
+   */
+  if (rvm->opts.durability == RVM_DURABLE_NONE) {
+    ret = fwrite(buf, sizeof(char), len, sh->redof) == len ? 0 : -1;
+    if (ret == 0)
+      sh->logend += len;
+    wake = rvm->opts.truncate_threshold > 0 &&
+           sh->logend - sh->ckpt >= (uint64_t) rvm->opts.truncate_threshold;
+    pthread_mutex_unlock(&(sh->loglock));
+    if (wake)
+      truncator_wake(rvm);
+    return ret;
   }
-}
 
-/*
-  destroy a segment completely, erasing its backing store. This function should not be called on a segment that is currently mapped.
- */
-void rvm_destroy(rvm_t rvm, const char *segname){
-  segment_t seg;
-  char path[PATH_BUF_SIZE + 1 + SEGNAME_SIZE];
+  start = sh->logend;
+  sh->logend += len;
+  epoch = sh->logepoch;
+  pthread_mutex_unlock(&(sh->loglock));
 
-  /* Get file path for segment */
-  get_file_path(rvm, segname, path);
+  t = rvm_trace_now();
+  ret = pwrite_all(sh->redofd, buf, len, (off_t) start);
+  stats_time(&(rvm->stats.log_write_ns), t);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_LOG_WRITE, t, (uint64_t) len);
 
-  if (seqsrchst_contains(segments, (seqsrchst_key) segname)) {
-    seg = (segment_t) seqsrchst_delete(segments, (seqsrchst_key) segname);
-    free(seg->segbase);
-    free(seg);
+  pthread_mutex_lock(&(sh->loglock));
 
-    /* erase backing store */
-    remove(path);
+  if (ret == 0) {
+    rangeset_add(&(sh->logwritten), (size_t) start, len, NULL, NULL);
+    done = (uint64_t) (sh->logwritten.ranges[0].offset + sh->logwritten.ranges[0].size);
+    if (done > sh->logdone) {
+      sh->logdone = done;
+      pthread_cond_broadcast(&(sh->logcond));
+    }
+  } else if (sh->logepoch == epoch && (sh->logfailed == 0 || start < sh->logfailed)) {
+    sh->logfailed = start;
+    pthread_cond_broadcast(&(sh->logcond));
   }
-}
 
-/*
-  begin a transaction that will modify the segments listed in segbases. If any of the specified segments is already being modified by a transaction, then the call should fail and return (trans_t) -1. Note that trant_t needs to be able to be typecasted to an integer type.
- */
-trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void **segbases){
-  int i;
-  void *segbase;
-  char *segname;
-  segment_t seg;
-  trans_t trans;
+  while (sh->logepoch == epoch && sh->logdone < start + len &&
+         (sh->logfailed == 0 || sh->logfailed >= start + len))
+    pthread_cond_wait(&(sh->logcond), &(sh->loglock));
 
-  /* First, set up the transaction structure */
-  if ((trans = (trans_t) malloc(sizeof(*trans))) == NULL) {
-    return (trans_t) -1;
+  /* Written, but behind a failed append that recovery will not get past */
+  if (sh->logepoch == epoch && sh->logfailed != 0 && sh->logfailed < start + len && ret == 0) {
+    errno = EIO;
+    ret = -1;
   }
 
-  trans->rvm = rvm;
-  trans->numsegs = numsegs;
-  trans->segments = malloc(numsegs * sizeof(trans->segments));
+  if (ret == 0 && rvm->opts.durability == RVM_DURABLE_FDATASYNC)
+    ret = log_sync(rvm, sh, start + len, epoch);
 
-  /* Add the segments to the transaction, if possible */
-  for (i = 0; i < numsegs; i++) {
-    segbase = segbases[i];
-    
-    if (seqsrchst_contains(&(rvm->segst), (seqsrchst_key) segbase)) {
-      segname = (char *) seqsrchst_get(&(rvm->segst), (seqsrchst_key) segbase);
-     
-      if (seqsrchst_contains(segments, (seqsrchst_key) segname)) {
-        seg = (segment_t) seqsrchst_get(segments, (seqsrchst_key) segname);
-
-        /* There is a current transaction using this segment */
-        if ((long int) seg->cur_trans != -1) {
-          printf("There is a current transaction using this segment\n");
-          fflush(stdout);
-          return (trans_t) -1;
-        } else {
-          /* Set the mappings between segment and transaction */
-          seg->cur_trans = trans;
-          trans->segments[i] = seg;
-        }
+  wake = rvm->opts.truncate_threshold > 0 &&
+         sh->logdone - sh->ckpt >= (uint64_t) rvm->opts.truncate_threshold;
 
-      } else {
-        /* Error case: segment not found */
-        printf("Segment not found\n");
-        fflush(stdout);
-        return (trans_t) -1;
-      }
- 
-    } else {
-      /* Error case: segment not mapped */
-      printf("The segment is not mapped\n");
-      fflush(stdout);
-      return (trans_t) -1;
-    }
-  }
+  pthread_mutex_unlock(&(sh->loglock));
 
-  return trans;
+  /* Wake the background truncator once enough log has built up */
+  if (wake)
+    truncator_wake(rvm);
+
+  return ret;
 }
 
 /*
-  declare that the library is about to modify a specified range of memory in the specified segment. The segment must be one of the segments specified in the call to rvm_begin_trans. Your library needs to ensure that the old memory has been saved, in case an abort is executed. It is legal call rvm_about_to_modify multiple times on the same memory area.
+  Re-reads the log size after writes that bypassed log_append, which
+  leaves the whole log written. Called with the log lock held and no
+  appends in flight.
 */
-void rvm_about_to_modify(trans_t tid, void *segbase, int offset, int size){
-  char *segname, *data_segbase;
-  segment_t seg;
-  mod_t *mod;
-  int numentries;
+static void log_resync_end(rvm_shard_t *sh) {
+  struct stat st;
 
-  /* Look up segment data structure by segbase */
-  if (seqsrchst_contains(&(tid->rvm->segst), (seqsrchst_key) segbase)) {
-    segname = (char *) seqsrchst_get(&(tid->rvm->segst), (seqsrchst_key) segbase);
+  if (fstat(sh->redofd, &st) == 0)
+    sh->logend = (uint64_t) st.st_size;
 
-    if (seqsrchst_contains(segments, (seqsrchst_key) segname)) {
-      seg = (segment_t) seqsrchst_get(segments, (seqsrchst_key) segname);
-    } else {
-      printf("Hit error condition:  segment name not found\n");
-      fflush(stdout);
-      return;
-    }
-  } else { 
-    printf("Hit error condition:  segment base not part of transaction\n");
-    fflush(stdout);
+  sh->logdone = sh->logend;
+  if (sh->logsynced > sh->logend)
+    sh->logsynced = sh->logend;
+  rangeset_clear(&(sh->logwritten));
+  rangeset_add(&(sh->logwritten), 0, (size_t) sh->logend, NULL, NULL);
+}
+
+/*
+  Without durability, pushes what the stdio buffer holds into the log
+  and takes the end from the file, which leaves logdone and logend
+  exact; until then stdio may write any part of it at any time. Does
+  nothing at the other durability levels. Called with the log lock
+  held.
+*/
+static void log_drain(rvm_shard_t *sh) {
+  if (sh->redof == NULL)
     return;
-  }
 
-  /* Verify that transaction is correct for this segment */
-  /* Just look at the pointer address... is there a reasonable better way? */
-  if (tid != seg->cur_trans) {
-    printf("This segment is not part of the current transaction %p, but instead of %p\n", tid, seg->cur_trans);
+  if (fflush(sh->redof) != 0) {
+    printf("Couldn't flush log file with error %d\n", errno);
     fflush(stdout);
-    return;
   }
+  log_resync_end(sh);
+}
 
-  /* Create an undo log entry */
-  mod = (mod_t *) malloc(sizeof(mod_t));
-  mod->offset = offset;
-  mod->size = size;
-  mod->undo = malloc(size);
-  data_segbase = (char *) segbase;
-  memcpy(mod->undo, &(data_segbase[offset]), (size_t) size);
-  steque_push(&(seg->mods), mod);
+/*
+  Hands out the id of a commit that spans several shards. Its parts
+  may only be truncated once xshard_done says they are all written.
+*/
+static uint64_t xshard_begin(rvm_t rvm) {
+  uint64_t xid;
+
+  pthread_mutex_lock(&(rvm->xlock));
+  xid = rvm->xnext++;
+  pthread_mutex_unlock(&(rvm->xlock));
 
-  /* Prepare redo log entry */
-  redolog->numentries++;
-  numentries = redolog->numentries;
-  redolog->entries = (segentry_t *) realloc(redolog->entries, redolog->numentries * sizeof(segentry_t));
-  strcpy(redolog->entries[numentries - 1].segname, segname);
-  redolog->entries[numentries - 1].segsize = seg->size;
-  redolog->entries[numentries - 1].updatesize = size;
+  return xid;
+}
 
-  /* For now, assume one single update per entry in a transaction */
-  redolog->entries[numentries - 1].numupdates = 1;
-  redolog->entries[numentries - 1].offsets = (int *) malloc(sizeof(int)); 
-  redolog->entries[numentries - 1].offsets[0] = offset;
-  redolog->entries[numentries - 1].sizes = (int *) malloc(sizeof(int));
-  redolog->entries[numentries - 1].sizes[0] = size;
-  redolog->entries[numentries - 1].data = segbase;
+static void xshard_done(rvm_t rvm, uint64_t xid) {
+  pthread_mutex_lock(&(rvm->xlock));
+  rangeset_add(&(rvm->xdone), (size_t) xid, 1, NULL, NULL);
+  pthread_cond_broadcast(&(rvm->xcond));
+  pthread_mutex_unlock(&(rvm->xlock));
 }
 
 /*
-commit all changes that have been made within the specified transaction. When the call returns, then enough information should have been saved to disk so that, even if the program crashes, the changes will be seen by the program when it restarts.
+  Waits until every cross-shard commit handed an id so far has all its
+  parts in the logs, and returns the highest such id. Any part below a
+  log offset read before the call then belongs to a whole commit.
 */
-void rvm_commit_trans(trans_t tid){
-  int i, offset, size;
-  char *segname;
-  segment_t seg;
-  mod_t *mod;
-  FILE *f;
-  char *data;
-  int writes;
-  char redopath[REDO_PATH_BUF_SIZE];
+static uint64_t xshard_settle(rvm_t rvm) {
+  uint64_t next;
 
-  strcpy(redopath, tid->rvm->prefix);
-  strcat(redopath, "/redo.log");
-  f = fopen(redopath, "a");
+  pthread_mutex_lock(&(rvm->xlock));
+  next = rvm->xnext;
+  while ((uint64_t) (rvm->xdone.ranges[0].offset + rvm->xdone.ranges[0].size) < next)
+    pthread_cond_wait(&(rvm->xcond), &(rvm->xlock));
+  pthread_mutex_unlock(&(rvm->xlock));
 
-  if (f == NULL) {
-    printf("Couldn't open file with error %d\n", errno);
-    fflush(stdout);
+  return next - 1;
+}
+
+/* Skips the parts of cross-shard commits that a crash left incomplete; an rvm_log_frame_fn */
+static int xshard_filter(void *arg, uint64_t xid, uint64_t shards) {
+  rvm_t rvm = (rvm_t) arg;
+
+  (void) shards;
+  return linprobst_contains(&(rvm->xskip), (linprobst_key) (uintptr_t) (xid + 1));
+}
+
+static void release_trans(trans_t tid);
+static void truncator_init(rvm_t rvm);
+static void *truncator(void *arg);
+static void segfd_drop(rvm_t rvm, const char *segname);
+static int track_fault(void *arg, void *addr);
+static int lazy_fault(void *arg, void *addr);
+static void track_protect(segment_t seg, int prot);
+static void track_arm(segment_t seg);
+static void track_settle(segment_t seg);
+static void track_free(segment_t seg);
+static void snap_detach(segment_t seg);
+
+static void timespec_add_us(struct timespec *ts, long us) {
+  ts->tv_sec += us / 1000000;
+  ts->tv_nsec += (us % 1000000) * 1000;
+  if (ts->tv_nsec >= 1000000000) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
   }
+}
 
-  /* Write redo log entries to log segment on disk */
-  for (i = 0; i < redolog->numentries; i++) {
-    /* Prepare buffer for writing a line to file */
-    segname = redolog->entries[i].segname;
-    size = redolog->entries[i].sizes[0];
-    offset = redolog->entries[i].offsets[0];
+/*
+  Group commit flusher: waits for a batch to fill up or time out, then
+  writes it to the logs with a single append and a single sync each.
+  Swapping a batch out wakes committers waiting for room as well as
+  those waiting for durability. The commits of a batch that could not
+  be written are added to the failed set for their committers to find.
+*/
+static void *group_flusher(void *arg) {
+  rvm_t rvm = (rvm_t) arg;
+  rvm_group_t *g = &(rvm->group);
+  struct timespec deadline;
+  rvm_batch_t *b;
+  uint64_t seq, t;
+  int i, n, failed;
+
+  pthread_mutex_lock(&(g->lock));
+  for (;;) {
+    if (g->count == 0) {
+      pthread_cond_wait(&(g->staged), &(g->lock));
+      continue;
+    }
 
-    data = (char *) redolog->entries[i].data;
+    /* Give the batch until its deadline to fill up */
+    if (g->count < rvm->opts.group_commit_batch && !g->flush_req) {
+      deadline = g->first;
+      timespec_add_us(&deadline, rvm->opts.group_commit_delay_us);
+      if (pthread_cond_timedwait(&(g->staged), &(g->lock), &deadline) != ETIMEDOUT)
+        continue;
+    }
 
-    writes = fprintf(f, "%s,%d,%d,", segname, offset, size);
-    writes += fwrite(&(data[offset]), sizeof(char), size, f);
-    writes += fprintf(f, "\n");
+    /* Swap in the spare batch so committers can keep staging */
+    b = g->batch;
+    seq = g->staged_seq;
+    n = g->count;
+    g->batch = g->spare;
+    g->count = 0;
+    g->flush_req = 0;
+    pthread_cond_broadcast(&(g->durable));
+    pthread_mutex_unlock(&(g->lock));
+
+    t = rvm_trace_now();
+
+    failed = 0;
+    for (i = 0; i < rvm->nshards; i++) {
+      if (b->lens[i] > 0 && log_append(rvm, &(rvm->shards[i]), b->bufs[i], b->lens[i]) != 0) {
+        printf("Couldn't write group commit batch with error %d\n", errno);
+        fflush(stdout);
+        failed = 1;
+      }
+      b->lens[i] = 0;
+    }
 
-    /* Clean up in-memory redo log entries */
-    free(redolog->entries[i].sizes);
-    free(redolog->entries[i].offsets);
+    /* Cross-shard commits are whole once every shard's part is written */
+    for (i = 0; i < b->nxids; i++)
+      xshard_done(rvm, b->xids[i]);
+    b->nxids = 0;
+    rvm_trace_add(&(rvm->trace), RVM_TRACE_GROUP_FLUSH, t, (uint64_t) n);
+
+    pthread_mutex_lock(&(g->lock));
+    if (failed)
+      rangeset_add(&(g->failed), (size_t) (seq - n + 1), (size_t) n, NULL, NULL);
+    g->spare = b;
+    g->durable_seq = seq;
+    pthread_cond_broadcast(&(g->durable));
   }
 
-  /* Flush the file to disk */
-  fclose(f);
+  return NULL;
+}
 
-  /* Clean up in-memory redo log entries */
-  free(redolog->entries);
-  redolog->entries = NULL;
-  redolog->numentries = 0;
+static rvm_batch_t *batch_new(int nshards) {
+  rvm_batch_t *b;
 
-  /* For all segments that are part of the transaction */
-  for (i = 0; i < tid->numsegs; i++) {
-    seg = tid->segments[i];
+  b = calloc(1, sizeof(*b));
+  b->bufs = calloc(nshards, sizeof(char *));
+  b->lens = calloc(nshards, sizeof(size_t));
+  b->caps = calloc(nshards, sizeof(size_t));
 
-    /* Clean up undo log */
-    while (!steque_isempty(&(seg->mods))) {
-      mod = (mod_t *) steque_pop(&(seg->mods));
-      free(mod->undo);
-      free(mod);
-    }
+  return b;
+}
 
-    /* Reset transaction id */
-    seg->cur_trans = (trans_t) -1;
+static void group_init(rvm_t rvm) {
+  rvm_group_t *g = &(rvm->group);
+  pthread_condattr_t attr;
+
+  pthread_mutex_init(&(g->lock), NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&(g->staged), &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&(g->durable), NULL);
+  rangeset_init(&(g->failed));
+
+  if (rvm->opts.group_commit_batch > 0) {
+    g->batch = batch_new(rvm->nshards);
+    g->spare = batch_new(rvm->nshards);
+    pthread_create(&(g->flusher), NULL, group_flusher, rvm);
   }
+}
 
-  free(tid->segments);
-  free(tid);
+/* Grows *buf to hold at least need bytes. Returns 0, or -1 if out of memory */
+static int grow_buf(char **buf, size_t *cap, size_t need) {
+  char *nbuf;
+  size_t ncap;
+
+  if (need <= *cap)
+    return 0;
+
+  ncap = *cap ? *cap : 4096;
+  while (ncap < need)
+    ncap *= 2;
+  if ((nbuf = realloc(*buf, ncap)) == NULL)
+    return -1;
+  *buf = nbuf;
+  *cap = ncap;
+
+  return 0;
 }
 
-/*
-  undo all changes that have happened within the specified transaction.
- */
-void rvm_abort_trans(trans_t tid){
+/* Did the batch holding commit seq fail to reach the logs? Called with the group lock held */
+static int group_failed(rvm_group_t *g, uint64_t seq) {
   int i;
-  segment_t seg;
-  mod_t *mod;
-  char *data;
-
-  /* For all segments that are part of the transaction */
-  for (i = 0; i < tid->numsegs; i++) {
-    seg = tid->segments[i];
 
-    data = (char *) seg->segbase;
+  for (i = 0; i < g->failed.N; i++) {
+    if (seq >= g->failed.ranges[i].offset &&
+        seq - g->failed.ranges[i].offset < g->failed.ranges[i].size)
+      return 1;
+  }
 
-    /* Apply undo log back to memory and clean it up */
-    while (!steque_isempty(&(seg->mods))) {
-      mod = (mod_t *) steque_pop(&(seg->mods));
-      memcpy(&(data[mod->offset]), mod->undo, (size_t) mod->size);
+  return 0;
+}
 
-      free(mod->undo);
-      free(mod);
+/*
+  Stages a commit's frames in the current batch: parts[i] bytes for
+  shard i, one after the other in records. xid is the commit's id if
+  it spans several shards, 0 if not. If the batch is already full,
+  first waits for the flusher to swap it out. Unless the rvm is in
+  async mode, then waits until the batch is on disk. Returns 0, or -1
+  if the commit could not be staged or its batch could not be written;
+  in async mode the latter only shows in the flusher's message.
+*/
+static int group_stage(rvm_t rvm, const char *records, const size_t *parts, uint64_t xid) {
+  rvm_group_t *g = &(rvm->group);
+  rvm_batch_t *b;
+  uint64_t seq, *xids;
+  int i, cap, ret = 0;
+
+  pthread_mutex_lock(&(g->lock));
+
+  /* A full batch waits for the flusher to take it, so none outgrows the cap */
+  while (g->count >= rvm->opts.group_commit_batch)
+    pthread_cond_wait(&(g->durable), &(g->lock));
+
+  b = g->batch;
+  for (i = 0; i < rvm->nshards && ret == 0; i++)
+    ret = grow_buf(&(b->bufs[i]), &(b->caps[i]), b->lens[i] + parts[i]);
+  if (ret == 0 && xid != 0 && b->nxids == b->capxids) {
+    cap = b->capxids ? 2 * b->capxids : 16;
+    if ((xids = realloc(b->xids, cap * sizeof(uint64_t))) == NULL) {
+      ret = -1;
+    } else {
+      b->xids = xids;
+      b->capxids = cap;
     }
-
-    /* Reset transaction id */
-    seg->cur_trans = (trans_t) -1;
+  }
+  if (ret != 0) {
+    printf("Failed to grow group commit buffer, bailing...\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&(g->lock));
+    /* No part of it reaches the logs, so truncation need not wait for it */
+    if (xid != 0)
+      xshard_done(rvm, xid);
+    return -1;
   }
 
-  /* Clean up in-memory redo log entries */
-  for (i = 0; i < redolog->numentries; i++) {
-    free(redolog->entries[i].sizes);
-    free(redolog->entries[i].offsets);
+  for (i = 0; i < rvm->nshards; i++) {
+    memcpy(b->bufs[i] + b->lens[i], records, parts[i]);
+    b->lens[i] += parts[i];
+    records += parts[i];
+  }
+  if (xid != 0)
+    b->xids[b->nxids++] = xid;
+
+  if (g->count++ == 0)
+    clock_gettime(CLOCK_MONOTONIC, &(g->first));
+  seq = ++(g->staged_seq);
+  pthread_cond_signal(&(g->staged));
+
+  if (!rvm->opts.group_commit_async) {
+    while (g->durable_seq < seq)
+      pthread_cond_wait(&(g->durable), &(g->lock));
+    if (group_failed(g, seq))
+      ret = -1;
   }
 
-  free(redolog->entries);
-  redolog->entries = NULL;
-  redolog->numentries = 0;
+  pthread_mutex_unlock(&(g->lock));
 
-  free(tid->segments);
-  free(tid);
+  return ret;
 }
 
 /*
- play through any committed or aborted items in the log file(s) and shrink the log file(s) as much as possible.
+  Wait until every staged or buffered commit is in the log.
 */
-void rvm_truncate_log(rvm_t rvm){
-  FILE *segfile, *logfile;
-  int offset, size, ret;
-  char redopath[REDO_PATH_BUF_SIZE];
-  char segpath[PATH_BUF_SIZE + SEGNAME_SIZE];
-  char *segname, *offsetstr, *sizestr, *data;
-  char *line = NULL;
-  size_t linelen, bufsz;
+void rvm_flush(rvm_t rvm) {
+  rvm_group_t *g = &(rvm->group);
+  rvm_shard_t *sh;
+  uint64_t seq;
+  int i;
+
+  if (rvm->opts.group_commit_batch > 0) {
+    pthread_mutex_lock(&(g->lock));
+    seq = g->staged_seq;
+    if (g->durable_seq < seq) {
+      g->flush_req = 1;
+      pthread_cond_signal(&(g->staged));
+      while (g->durable_seq < seq)
+        pthread_cond_wait(&(g->durable), &(g->lock));
+    }
+    pthread_mutex_unlock(&(g->lock));
+  }
 
-  strcpy(redopath, rvm->prefix);
-  strcat(redopath, "/redo.log");
+  for (i = 0; i < rvm->nshards; i++) {
+    sh = &(rvm->shards[i]);
+    if (sh->redof == NULL)
+      continue;
+    pthread_mutex_lock(&(sh->loglock));
+    log_drain(sh);
+    pthread_mutex_unlock(&(sh->loglock));
+  }
+}
+
+/*
+  A crash can leave a partly written record at the end of a log.
+  Cut it off, or every record appended after it would be unreachable.
+  Records before the checkpoint are applied and may have been punched
+  out, so the scan starts there.
+*/
+static void log_trim_torn_tail(rvm_shard_t *sh, const char *redopath) {
+  struct stat st;
+  uint64_t end;
 
-  logfile = fopen(redopath, "r");
+  if (fstat(sh->redofd, &st) != 0 || (uint64_t) st.st_size <= sh->ckpt)
+    return;
 
-  if (logfile == NULL) {
-    printf("Couldn't get log file handle with error %d\n", errno);
+  if (rvm_log_replay(redopath, sh->ckpt, 0, &end, NULL, NULL, NULL, NULL) >= 0 &&
+      end < (uint64_t) st.st_size) {
+    printf("Discarding %llu bytes of torn log tail\n",
+           (unsigned long long) ((uint64_t) st.st_size - end));
     fflush(stdout);
+    if (ftruncate(sh->redofd, (off_t) end) != 0) {
+      printf("Couldn't trim log file with error %d\n", errno);
+      fflush(stdout);
+    }
   }
+}
 
-  /* For every entry in the log file */
-  while ((linelen = getline(&line, &bufsz, logfile)) != -1) {
-    /* Extract segment name */
-    segname = strtok(line, ",");
+/*
+  Opens log shard i, stamping the format header on a new one, and
+  picks up at checkpoint ckpt. Appends write at offsets they reserve,
+  so the log is not opened O_APPEND.
+*/
+static void shard_open(rvm_t rvm, int i, uint64_t ckpt) {
+  rvm_shard_t *sh = &(rvm->shards[i]);
+  char redopath[REDO_PATH_BUF_SIZE];
+  struct stat st;
+  int flags;
+
+  memset(sh, 0, sizeof(*sh));
+  shard_path(rvm, i, redopath);
+  flags = O_WRONLY | O_CREAT;
+  if (rvm->opts.durability == RVM_DURABLE_DSYNC) {
+    flags |= O_DSYNC;
+  }
+  sh->redofd = open(redopath, flags, 0644);
 
-    /* Extract offset */
-    offsetstr = strtok(NULL, ",");
-    offset = atoi(offsetstr);
+  if (sh->redofd < 0) {
+    printf("Couldn't open log file with error %d\n", errno);
+    fflush(stdout);
+  } else if (fstat(sh->redofd, &st) == 0 && st.st_size == 0) {
+    rvm_log_write_header(sh->redofd);
+  }
+  pthread_mutex_init(&(sh->loglock), NULL);
+  pthread_cond_init(&(sh->logcond), NULL);
+  rangeset_init(&(sh->logwritten));
+  log_resync_end(sh);
+
+  /* A missing or out of range checkpoint means replay from the start */
+  if (ckpt < rvm_log_first_record() || ckpt > sh->logend)
+    ckpt = rvm_log_first_record();
+  sh->ckpt = ckpt;
+
+  log_trim_torn_tail(sh, redopath);
+  log_resync_end(sh);
+
+  /* Without any durability, commits only fill a large stdio buffer */
+  if (rvm->opts.durability == RVM_DURABLE_NONE && sh->redofd >= 0) {
+    sh->redof = fdopen(dup(sh->redofd), "a");
+    setvbuf(sh->redof, NULL, _IOFBF, 1 << 20);
+  }
+}
 
-    /* Extract data size */
-    sizestr = strtok(NULL, ",");
-    size = atoi(sizestr);
+static void shard_close(rvm_shard_t *sh) {
+  if (sh->redof != NULL)
+    fclose(sh->redof);
+  if (sh->redofd >= 0)
+    close(sh->redofd);
+  pthread_mutex_destroy(&(sh->loglock));
+  pthread_cond_destroy(&(sh->logcond));
+  rangeset_destroy(&(sh->logwritten));
+}
 
-    /* Extract data */
-    data = sizestr + (strlen(sizestr)+1);
+/* What the startup scan found of one cross-shard commit */
+typedef struct xscan_t{
+  rvm_t rvm;
+  int shard;                  /*Shard being scanned*/
+  linprobst_t found;          /*Commit id + 1 -> mask of shards holding a part*/
+  linprobst_t want;           /*Commit id + 1 -> mask of shards that should*/
+  uint64_t maxid;
+} xscan_t;
+
+static int xscan_frame(void *arg, uint64_t xid, uint64_t shards) {
+  xscan_t *x = (xscan_t *) arg;
+  linprobst_key key = (linprobst_key) (uintptr_t) (xid + 1);
+  uintptr_t found;
+
+  found = (uintptr_t) linprobst_get(&(x->found), key);
+  linprobst_put(&(x->found), key, (linprobst_value) (found | ((uintptr_t) 1 << x->shard)));
+  linprobst_put(&(x->want), key, (linprobst_value) (uintptr_t) shards);
+  if (xid > x->maxid)
+    x->maxid = xid;
+
+  /* Only counting here */
+  return 1;
+}
 
-    /* Look up the segment path and open the file (if not already open) */
-    get_file_path(rvm, segname, segpath);
-    segfile = fopen(segpath, "r+");
+/*
+  Finds the cross-shard commits a crash interrupted before every part
+  reached its log. Their parts must never be applied. Commits up to
+  rvm->xckpt were whole when the checkpoint was written, so parts of
+  them that are missing were applied already; past it, a part missing
+  from its log past the checkpoint was never written.
+*/
+static void xshard_recover(rvm_t rvm) {
+  char redopath[REDO_PATH_BUF_SIZE];
+  xscan_t x;
+  uint64_t xid;
+  int i;
 
-    if (segfile == NULL) {
-      printf("Couldn't get log file handle with error %d\n", errno);
-      fflush(stdout);
-    }
+  x.rvm = rvm;
+  x.maxid = rvm->xckpt;
+  linprobst_init(&(x.found), linprobst_ptrhash, segbase_keyeq);
+  linprobst_init(&(x.want), linprobst_ptrhash, segbase_keyeq);
 
-    /* Write out data to segment file based on log entry */
-    ret = fseek(segfile, offset, SEEK_SET);
+  for (i = 0; i < rvm->nshards; i++) {
+    x.shard = i;
+    shard_path(rvm, i, redopath);
+    rvm_log_replay(redopath, rvm->shards[i].ckpt, 0, NULL, NULL, NULL, xscan_frame, &x);
+  }
 
-    if (ret != 0) {
-      printf("Couldn't seek in segfile with error %d\n", errno);
-      fflush(stdout);
+  for (xid = rvm->xckpt + 1; xid <= x.maxid; xid++) {
+    if (linprobst_get(&(x.found), (linprobst_key) (uintptr_t) (xid + 1)) !=
+        linprobst_get(&(x.want), (linprobst_key) (uintptr_t) (xid + 1))) {
+      linprobst_put(&(rvm->xskip), (linprobst_key) (uintptr_t) (xid + 1), (linprobst_value) 1);
     }
+  }
+  if (linprobst_size(&(rvm->xskip)) > 0) {
+    printf("Dropping %d cross-shard commits a crash left incomplete\n", linprobst_size(&(rvm->xskip)));
+    fflush(stdout);
+  }
 
-    ret = fwrite(data, sizeof(char), size, segfile);
+  /* Ids go on from the highest one still around */
+  rvm->xnext = x.maxid + 1;
+  rangeset_add(&(rvm->xdone), 0, (size_t) rvm->xnext, NULL, NULL);
 
-    if (ret != size) {
-      printf("Writing out %d bytes of data to %s, expected %d bytes\n", ret, segpath, size);
-      fflush(stdout);
+  linprobst_destroy(&(x.found));
+  linprobst_destroy(&(x.want));
+}
+
+static long truncate_pass(rvm_t rvm, int use_mappings, uint64_t step, int only);
+static void write_ckpt(rvm_t rvm, uint64_t xid);
+
+/*
+  Applies everything in the logs, which is needed before the number of
+  shards can change or once commits are to be dropped, and then moves
+  to nshards logs. If the logs cannot be emptied, the old ones stay.
+*/
+static void shards_rebuild(rvm_t rvm, int nshards) {
+  char redopath[REDO_PATH_BUF_SIZE];
+  int i, empty = 1;
+
+  truncate_pass(rvm, 0, 0, -1);
+  for (i = 0; i < rvm->nshards; i++) {
+    if (rvm->shards[i].logend > rvm_log_first_record())
+      empty = 0;
+  }
+
+  if (!empty) {
+    printf("Couldn't apply all of the log, keeping %d shards\n", rvm->nshards);
+    fflush(stdout);
+    return;
+  }
+
+  /* Nothing is left of the incomplete commits */
+  linprobst_destroy(&(rvm->xskip));
+  linprobst_init(&(rvm->xskip), linprobst_ptrhash, segbase_keyeq);
+
+  if (nshards == rvm->nshards)
+    return;
+
+  for (i = 0; i < rvm->nshards; i++) {
+    shard_close(&(rvm->shards[i]));
+    if (i >= nshards) {
+      shard_path(rvm, i, redopath);
+      unlink(redopath);
+    }
+  }
+
+  rvm->nshards = nshards;
+  rvm->shards = realloc(rvm->shards, nshards * sizeof(rvm_shard_t));
+  for (i = 0; i < nshards; i++)
+    shard_open(rvm, i, rvm_log_first_record());
+  write_ckpt(rvm, rvm->xnext - 1);
+}
+
+/*
+  Initialize the library with the specified directory as backing store.
+*/
+rvm_t rvm_init(const char *directory){
+  return rvm_init_opts(directory, NULL);
+}
+
+rvm_t rvm_init_opts(const char *directory, const rvm_options_t *opts){
+  struct stat st = {0};
+  rvm_t rvm;
+  int nshards;
+
+  rvm = calloc(1, sizeof(*rvm));
+
+  if (opts != NULL) {
+    rvm->opts = *opts;
+  }
+  if (rvm->opts.durability == RVM_DURABLE_DEFAULT) {
+    rvm->opts.durability = RVM_DURABLE_FDATASYNC;
+  }
+  nshards = rvm->opts.log_shards;
+  if (nshards < 1)
+    nshards = 1;
+  if (nshards > RVM_SHARDS_MAX)
+    nshards = RVM_SHARDS_MAX;
+
+  /* Only make the directory if it does not exist */
+  if (stat(directory, &st) == -1) {
+    mkdir(directory, 0744);
+  }
+
+  strncpy(rvm->prefix, directory, (PATH_BUF_SIZE - 1));
+
+  /* Initialize data structures too */
+  pthread_rwlock_init(&(rvm->maplock), NULL);
+  pthread_mutex_init(&(rvm->poollock), NULL);
+  pthread_mutex_init(&(rvm->snaplock), NULL);
+  linprobst_init(&(rvm->segments), linprobst_strhash, segname_keyeq);
+  linprobst_init(&(rvm->segst), linprobst_ptrhash, segbase_keyeq);
+  linprobst_init(&(rvm->snapshots), linprobst_ptrhash, segbase_keyeq);
+  pthread_mutex_init(&(rvm->xlock), NULL);
+  pthread_cond_init(&(rvm->xcond), NULL);
+  rangeset_init(&(rvm->xdone));
+  linprobst_init(&(rvm->xskip), linprobst_ptrhash, segbase_keyeq);
+  rvm_trace_init(&(rvm->trace), rvm->opts.trace_events > 0 ? (size_t) rvm->opts.trace_events : 0);
+
+  /*
+   * Open the logs as the last run left them. Commits a crash tore
+   * across shards, and a change in the number of shards, both need
+   * the logs applied and emptied first.
+   */
+  truncator_init(rvm);
+  xshard_recover(rvm);
+  if (linprobst_size(&(rvm->xskip)) > 0 || rvm->nshards != nshards)
+    shards_rebuild(rvm, nshards);
+
+  if (rvm->opts.lazy_recovery && rvm_fault_register(lazy_fault, rvm) != 0) {
+    printf("Couldn't install fault handler, lazy recovery is off\n");
+    fflush(stdout);
+    rvm->opts.lazy_recovery = 0;
+  }
+  if (rvm->opts.page_tracking && rvm_fault_register(track_fault, rvm) != 0) {
+    printf("Couldn't install write fault handler, page tracking is off\n");
+    fflush(stdout);
+    rvm->opts.page_tracking = 0;
+  }
+
+  group_init(rvm);
+  if (rvm->opts.truncate_threshold > 0) {
+    pthread_create(&(rvm->trunc.worker), NULL, truncator, rvm);
+  }
+
+  return rvm;
+}
+
+/*
+  mmap'ed variant of rvm_map: the segment file is grown sparsely if
+  needed and mapped copy-on-write, so pages are only read in when
+  touched. A second, shared mapping lets truncation write committed
+  records straight into the file's pages.
+*/
+static void *rvm_map_mmap(rvm_t rvm, const char *segname, size_t size_to_create, const char *path){
+  segment_t seg;
+  struct stat st;
+  int fd;
+  size_t size;
+
+  if ((seg = (segment_t) linprobst_get(&(rvm->segments), (linprobst_key) segname)) != NULL) {
+    /* If we are remapping an existing mapped memory location, we need to bail */
+    if (seg->segbase != NULL &&
+        linprobst_contains(&(rvm->segst), (linprobst_key) seg->segbase)) {
+      printf("Remapping existing mem segment, bailing...\n");
+      fflush(stdout);
+      return (void *) -1;
+    }
+  } else {
+    seg = calloc(1, sizeof(*seg));
+    strncpy(seg->segname, segname, SEGNAME_SIZE-1);
+    seg->cur_trans = (trans_t) -1;
+    seg->mods = NULL;
+    seg->memfd = -1;
+    seg->shard = shard_of(rvm, segname);
+    rangeset_init(&(seg->dirty));
+    rangeset_init(&(seg->captured));
+    rangeset_init(&(seg->delta));
+    pthread_mutex_init(&(seg->snaplock), NULL);
+    linprobst_put(&(rvm->segments), (linprobst_key) seg->segname, (linprobst_value) seg);
+  }
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) != 0) {
+    printf("Couldn't open segment file %s with error %d\n", path, errno);
+    fflush(stdout);
+    if (fd >= 0)
+      close(fd);
+    return (void *) -1;
+  }
+
+  /* Grow the file sparsely; the new tail reads back as zeros */
+  size = size_to_create;
+  if ((size_t) st.st_size < size) {
+    if (ftruncate(fd, (off_t) size) != 0) {
+      printf("Couldn't extend segment file %s with error %d\n", path, errno);
+      fflush(stdout);
+      close(fd);
+      return (void *) -1;
+    }
+  } else {
+    size = (size_t) st.st_size;
+  }
+
+  /*
+   * Only pages written get a private copy, so segments larger than
+   * memory must not have swap reserved for the whole mapping up front.
+   */
+  seg->segbase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+  seg->applybase = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (seg->segbase == MAP_FAILED || seg->applybase == MAP_FAILED) {
+    printf("Failed to mmap %s, bailing...\n", path);
+    fflush(stdout);
+    if (seg->segbase != MAP_FAILED)
+      munmap(seg->segbase, size);
+    if (seg->applybase != MAP_FAILED)
+      munmap(seg->applybase, size);
+    seg->segbase = NULL;
+    seg->applybase = NULL;
+    return (void *) -1;
+  }
+
+  seg->size = size;
+  add_mapping(rvm, seg);
+
+  return seg->segbase;
+}
+
+/*
+  Drops both mappings of an mmap'ed segment.
+*/
+static void unmap_mmap(segment_t seg){
+  munmap(seg->segbase, seg->size);
+  munmap(seg->applybase, seg->size);
+  seg->segbase = NULL;
+  seg->applybase = NULL;
+}
+
+static size_t page_round(size_t size){
+  size_t pagesize = rvm_fault_pagesize();
+
+  if (size == 0)
+    return pagesize;
+  return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+/*
+  Memory for malloc'ed segments: a shared mapping of an anonymous
+  memory file. The kernel hands out zeroed pages on first touch, so new
+  segments cost nothing until used, page tracking gets whole pages to
+  protect, and snapshots can map the same file copy-on-write.
+*/
+static void *segmem_alloc(segment_t seg, size_t size){
+  void *p;
+
+  if ((seg->memfd = memfd_create(seg->segname, MFD_CLOEXEC)) < 0)
+    return NULL;
+
+  p = MAP_FAILED;
+  if (ftruncate(seg->memfd, (off_t) page_round(size)) == 0)
+    p = mmap(NULL, page_round(size), PROT_READ | PROT_WRITE, MAP_SHARED, seg->memfd, 0);
+  if (p == MAP_FAILED) {
+    close(seg->memfd);
+    seg->memfd = -1;
+    return NULL;
+  }
+
+  return p;
+}
+
+static void segmem_free(segment_t seg){
+  if (seg->memfd < 0)
+    return;
+  munmap(seg->segbase, page_round(seg->size));
+  close(seg->memfd);
+  seg->memfd = -1;
+}
+
+/* Reads up to size bytes of fd into buf, stopping early at end of file */
+static int segfile_read_all(int fd, char *buf, size_t size){
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < size) {
+    n = pread(fd, buf + done, size - done, (off_t) done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    done += (size_t) n;
+  }
+
+  return 0;
+}
+
+/*
+  Reads the first size bytes of a segment file into buf, which is
+  already zeroed. Holes in a sparse file are skipped, so their pages
+  are never touched. Returns 0 on success.
+*/
+static int segfile_read(int fd, char *buf, size_t size){
+  off_t data, hole;
+  ssize_t n;
+
+  data = 0;
+  while ((size_t) data < size) {
+    /* Without SEEK_DATA support the whole file counts as data */
+    if ((data = lseek(fd, data, SEEK_DATA)) < 0)
+      return errno == ENXIO ? 0 : (errno == EINVAL ? segfile_read_all(fd, buf, size) : -1);
+    if ((size_t) data >= size)
+      break;
+    if ((hole = lseek(fd, data, SEEK_HOLE)) < 0)
+      return -1;
+    if ((size_t) hole > size)
+      hole = (off_t) size;
+
+    while (data < hole) {
+      n = pread(fd, buf + data, (size_t) (hole - data), data);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      data += n;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  malloc'ed variant of rvm_map: the whole segment is read into memory.
+  New and grown segments are sparse on disk and zero-filled lazily in
+  memory, so mapping them costs no I/O.
+*/
+static void *rvm_map_malloc(rvm_t rvm, const char *segname, size_t size_to_create, const char *path){
+  segment_t seg;
+  struct stat st;
+  int fd;
+
+  /* Check if segment exists by name */
+  if ((seg = (segment_t) linprobst_get(&(rvm->segments), (linprobst_key) segname)) != NULL) {
+    /* If we are remapping an existing mapped memory location, we need to bail */
+    if (linprobst_contains(&(rvm->segst), (linprobst_key) seg->segbase)) {
+      printf("Remapping existing mem segment, bailing...\n");
+      fflush(stdout);
+      return (void *) -1;
+    }
+
+    /*
+     * Start over with fresh memory, possibly larger: the old contents
+     * may be stale, and snapshots may still be sharing them.
+     */
+    snap_detach(seg);
+    segmem_free(seg);
+    if (seg->size < size_to_create)
+      seg->size = size_to_create;
+
+    if ((seg->segbase = segmem_alloc(seg, seg->size)) == NULL) {
+      /* We failed, so return error */
+      printf("Failed to realloc, bailing...\n");
+      fflush(stdout);
+      return (void *) -1;
+    }
+  } else {
+    /* Come here if the segment doesn't exist yet */
+    seg = calloc(1, sizeof(*seg));
+    strncpy(seg->segname, segname, SEGNAME_SIZE-1);
+    seg->size = size_to_create;
+    seg->cur_trans = (trans_t) -1;
+    seg->mods = NULL;
+    seg->shard = shard_of(rvm, segname);
+    rangeset_init(&(seg->dirty));
+    rangeset_init(&(seg->captured));
+    rangeset_init(&(seg->delta));
+    pthread_mutex_init(&(seg->snaplock), NULL);
+
+    /* If no, malloc memory, create log file, and put into data struct */
+    if ((seg->segbase = segmem_alloc(seg, size_to_create)) == NULL) {
+      /* We failed, so return error */
+      printf("Failed to malloc, bailing...\n");
+      fflush(stdout);
+      return (void *) -1;
+    } 
+
+    linprobst_put(&(rvm->segments), (linprobst_key) seg->segname, (linprobst_value) seg);
+  }
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) != 0) {
+    printf("Couldn't open segment file %s with error %d\n", path, errno);
+    fflush(stdout);
+    if (fd >= 0)
+      close(fd);
+    return (void *) -1;
+  }
+
+  /* Grow the file sparsely; the new tail reads back as zeros */
+  if ((size_t) st.st_size < seg->size && ftruncate(fd, (off_t) seg->size) != 0) {
+    printf("Couldn't extend segment file %s with error %d\n", path, errno);
+    fflush(stdout);
+    close(fd);
+    return (void *) -1;
+  }
+
+  /* Read in what the file already held */
+  if ((size_t) st.st_size > 0 &&
+      segfile_read(fd, (char *) seg->segbase,
+                   (size_t) st.st_size < seg->size ? (size_t) st.st_size : seg->size) != 0) {
+    printf("Couldn't read segment file %s with error %d\n", path, errno);
+    fflush(stdout);
+    close(fd);
+    return (void *) -1;
+  }
+  close(fd);
+
+  add_mapping(rvm, seg);
+
+  return seg->segbase;
+}
+
+/*
+  Copies a pending log record into the segment being mapped, if it is
+  one of that segment's records.
+*/
+static int overlay_apply(void *arg, const char *segname,
+                         uint64_t offset, const void *data, uint64_t length){
+  segment_t seg = (segment_t) arg;
+
+  if (strcmp(segname, seg->segname) != 0 || offset >= (uint64_t) seg->size)
+    return 0;
+
+  if (length > (uint64_t) seg->size - offset)
+    length = (uint64_t) seg->size - offset;
+  memcpy((char *) seg->segbase + offset, data, (size_t) length);
+
+  return 0;
+}
+
+/* Adds a pending log record to the plan of the segment being mapped lazily */
+static int lazy_gather(void *arg, const char *segname,
+                       uint64_t offset, const void *data, uint64_t length){
+  rvm_lazy_t *lazy = (rvm_lazy_t *) arg;
+  segment_t seg = lazy->seg;
+
+  if (strcmp(segname, seg->segname) != 0 || offset >= (uint64_t) seg->size)
+    return 0;
+
+  if (length > (uint64_t) seg->size - offset)
+    length = (uint64_t) seg->size - offset;
+  rvm_plan_add(&(lazy->plan), segname, offset, data, length);
+
+  return 0;
+}
+
+/*
+  Gathers the records of a lazily mapped segment from its log. The
+  segment cannot be written until they are, so no later commit of it
+  can be among them.
+*/
+static void *lazy_scan(void *arg){
+  rvm_lazy_t *lazy = (rvm_lazy_t *) arg;
+  rvm_t rvm = lazy->rvm;
+  char redopath[REDO_PATH_BUF_SIZE];
+  uint64_t t = rvm_trace_now();
+  long n;
+
+  /* Holding the reset lock before rvm_map lets go keeps the offsets valid */
+  pthread_rwlock_rdlock(&(rvm->trunc.resetlock));
+  pthread_mutex_lock(&(lazy->lock));
+  lazy->started = 1;
+  pthread_cond_signal(&(lazy->cond));
+  pthread_mutex_unlock(&(lazy->lock));
+
+  shard_path(rvm, lazy->seg->shard, redopath);
+  n = rvm_log_replay(redopath, lazy->start, lazy->end, NULL, lazy_gather, lazy, xshard_filter, rvm);
+  pthread_rwlock_unlock(&(rvm->trunc.resetlock));
+
+  rvm_plan_resolve(&(lazy->plan));
+  lazy->ps = lazy->plan.nsegs > 0 ? lazy->plan.segs[0] : NULL;
+  if (n > 0)
+    __sync_fetch_and_add(&(rvm->stats.replay_records), (uint64_t) n);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_LAZY_SCAN, t, (uint64_t) lazy->plan.bytes);
+
+  __sync_synchronize();
+  lazy->ready = 1;
+
+  return NULL;
+}
+
+/*
+  Protects a freshly mapped segment and starts gathering its records
+  from [start, end) of its log. Called with the map lock and the reset
+  lock held. Returns 0, or -1 if the records have to be applied now.
+*/
+static int lazy_start(rvm_t rvm, segment_t seg, uint64_t start, uint64_t end){
+  size_t size = page_round(seg->size);
+  rvm_lazy_t *lazy;
+
+  lazy = calloc(1, sizeof(*lazy));
+  lazy->rvm = rvm;
+  lazy->seg = seg;
+  lazy->start = start;
+  lazy->end = end;
+  pthread_mutex_init(&(lazy->lock), NULL);
+  pthread_cond_init(&(lazy->cond), NULL);
+  rvm_plan_init(&(lazy->plan), 0);
+  lazy->npages = size / rvm_fault_pagesize();
+  lazy->left = lazy->npages;
+  lazy->pages = calloc(lazy->npages, 1);
+
+  /* Pages are filled in through a view the application cannot see */
+  if (seg->applybase != NULL) {
+    lazy->view = (char *) seg->applybase;
+  } else {
+    lazy->view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->memfd, 0);
+    lazy->ownview = lazy->view != MAP_FAILED;
+  }
+
+  if (lazy->view == MAP_FAILED || mprotect(seg->segbase, size, PROT_NONE) != 0 ||
+      pthread_create(&(lazy->scanner), NULL, lazy_scan, lazy) != 0) {
+    printf("Couldn't set up lazy recovery of %s with error %d\n", seg->segname, errno);
+    fflush(stdout);
+    mprotect(seg->segbase, size, PROT_READ | PROT_WRITE);
+    if (lazy->ownview)
+      munmap(lazy->view, size);
+    rvm_plan_destroy(&(lazy->plan));
+    pthread_cond_destroy(&(lazy->cond));
+    pthread_mutex_destroy(&(lazy->lock));
+    free((void *) lazy->pages);
+    free(lazy);
+    return -1;
+  }
+
+  pthread_mutex_lock(&(lazy->lock));
+  while (!lazy->started)
+    pthread_cond_wait(&(lazy->cond), &(lazy->lock));
+  pthread_mutex_unlock(&(lazy->lock));
+
+  seg->lazy = lazy;
+
+  return 0;
+}
+
+/*
+  Applies the records of page i, unless another thread got there
+  first, in which case it waits for that thread. Signal safe.
+*/
+static void lazy_page(rvm_lazy_t *lazy, size_t i){
+  size_t pagesize = rvm_fault_pagesize();
+  segment_t seg = lazy->seg;
+  rvm_plan_seg_t *ps = lazy->ps;
+  uint64_t lo, hi, a, b;
+  int l, h, m;
+
+  if (!__sync_bool_compare_and_swap(&(lazy->pages[i]), LAZY_PENDING, LAZY_APPLYING)) {
+    while (lazy->pages[i] != LAZY_DONE)
+      sched_yield();
+    return;
+  }
+
+  lo = (uint64_t) i * pagesize;
+  hi = lo + pagesize;
+  if (hi > (uint64_t) seg->size)
+    hi = (uint64_t) seg->size;
+
+  /* The writes are sorted and disjoint; start at the first one ending past lo */
+  if (ps != NULL) {
+    l = 0;
+    h = ps->N;
+    while (l < h) {
+      m = (l + h) / 2;
+      if (ps->writes[m].offset + ps->writes[m].length <= lo)
+        l = m + 1;
+      else
+        h = m;
+    }
+    for (; l < ps->N && ps->writes[l].offset < hi; l++) {
+      a = ps->writes[l].offset > lo ? ps->writes[l].offset : lo;
+      b = ps->writes[l].offset + ps->writes[l].length;
+      if (b > hi)
+        b = hi;
+      memcpy(lazy->view + a, ps->writes[l].data + (a - ps->writes[l].offset), (size_t) (b - a));
+    }
+  }
+
+  mprotect((char *) seg->segbase + i * pagesize, pagesize, PROT_READ | PROT_WRITE);
+  __sync_synchronize();
+  lazy->pages[i] = LAZY_DONE;
+  __sync_fetch_and_sub(&(lazy->left), 1);
+}
+
+/*
+  Fault handler for lazy recovery: the first access to a page of a
+  lazily mapped segment applies the page's records, once they are
+  gathered.
+*/
+static int lazy_fault(void *arg, void *addr){
+  rvm_t rvm = (rvm_t) arg;
+  struct timespec nap = {0, 100000};
+  segment_t seg;
+  rvm_lazy_t *lazy;
+  size_t i;
+
+  seg = fault_mapping(rvm, addr);
+
+  /* Once every page is done, faults belong to page tracking or nobody */
+  if (seg == NULL || (lazy = seg->lazy) == NULL || lazy->left == 0)
+    return 0;
+
+  i = (size_t) ((char *) addr - (char *) seg->segbase) / rvm_fault_pagesize();
+  if (i >= lazy->npages)
+    return 0;
+
+  while (!lazy->ready)
+    nanosleep(&nap, NULL);
+  __sync_synchronize();
+
+  lazy_page(lazy, i);
+
+  return 1;
+}
+
+static void lazy_wait(rvm_lazy_t *lazy){
+  pthread_mutex_lock(&(lazy->lock));
+  if (!lazy->joined) {
+    pthread_join(lazy->scanner, NULL);
+    lazy->joined = 1;
+  }
+  pthread_mutex_unlock(&(lazy->lock));
+}
+
+/*
+  Recovers every page of a lazily mapped segment still pending, for
+  callers about to touch the segment where a fault cannot be handled.
+*/
+static void lazy_finish(segment_t seg){
+  rvm_lazy_t *lazy = seg->lazy;
+  size_t i;
+
+  if (lazy == NULL || lazy->left == 0)
+    return;
+
+  lazy_wait(lazy);
+  for (i = 0; i < lazy->npages; i++)
+    lazy_page(lazy, i);
+}
+
+/* Forgets about lazy recovery of an unmapped segment. Called with the map lock held */
+static void lazy_drop(segment_t seg){
+  rvm_lazy_t *lazy = seg->lazy;
+
+  if (lazy == NULL)
+    return;
+
+  lazy_wait(lazy);
+  if (lazy->ownview)
+    munmap(lazy->view, lazy->npages * rvm_fault_pagesize());
+  rvm_plan_destroy(&(lazy->plan));
+  pthread_cond_destroy(&(lazy->cond));
+  pthread_mutex_destroy(&(lazy->lock));
+  free((void *) lazy->pages);
+  free(lazy);
+  seg->lazy = NULL;
+}
+
+/*
+  map a segment from disk into memory. If the segment does not already exist, then create it and give it size size_to_create. If the segment exists but is shorter than size_to_create, then extend it until it is long enough. It is an error to try to map the same segment twice.
+*/
+void *rvm_map(rvm_t rvm, const char *segname, size_t size_to_create){
+  char path[PATH_BUF_SIZE + 1 + SEGNAME_SIZE];
+  char redopath[REDO_PATH_BUF_SIZE];
+  rvm_shard_t *sh;
+  segment_t seg;
+  void *segbase;
+  uint64_t start, end, t = rvm_trace_now();
+  int shard, lazy = 0;
+  long n;
+
+  /* Get file path for segment */
+  get_file_path(rvm, segname, path);
+  shard = shard_of(rvm, segname);
+
+  if (rvm->opts.truncate_threshold <= 0 && !rvm->opts.lazy_recovery) {
+    /* Do lazy log truncation, of just the log holding the segment */
+    rvm_flush(rvm);
+    truncate_pass(rvm, 1, 0, shard);
+
+    pthread_rwlock_wrlock(&(rvm->maplock));
+    if (rvm->opts.mmap_segments)
+      segbase = rvm_map_mmap(rvm, segname, size_to_create, path);
+    else
+      segbase = rvm_map_malloc(rvm, segname, size_to_create, path);
+    pthread_rwlock_unlock(&(rvm->maplock));
+
+    stats_time(&(rvm->stats.map_ns), t);
+    rvm_trace_add(&(rvm->trace), RVM_TRACE_MAP, t, 0);
+    return segbase;
+  }
+
+  /*
+   * The background truncator owns the segment files. Read the segment
+   * as it stands and then replay the records it has not applied yet;
+   * records it applies meanwhile are replayed again, which is harmless.
+   * With lazy recovery the replay is put off until each page is first
+   * touched. The shared reset lock keeps the log from being emptied
+   * under us.
+   */
+  rvm_flush(rvm);
+  pthread_rwlock_rdlock(&(rvm->trunc.resetlock));
+
+  sh = &(rvm->shards[shard]);
+  pthread_mutex_lock(&(sh->loglock));
+  start = sh->ckpt;
+  end = sh->logdone;
+  pthread_mutex_unlock(&(sh->loglock));
+
+  pthread_rwlock_wrlock(&(rvm->maplock));
+  if (rvm->opts.mmap_segments)
+    segbase = rvm_map_mmap(rvm, segname, size_to_create, path);
+  else
+    segbase = rvm_map_malloc(rvm, segname, size_to_create, path);
+
+  if (segbase != (void *) -1 && start < end) {
+    seg = (segment_t) linprobst_get(&(rvm->segments), (linprobst_key) segname);
+    lazy = rvm->opts.lazy_recovery && lazy_start(rvm, seg, start, end) == 0;
+    if (!lazy) {
+      shard_path(rvm, shard, redopath);
+      n = rvm_log_replay(redopath, start, end, NULL, overlay_apply, seg, xshard_filter, rvm);
+      if (n > 0)
+        __sync_fetch_and_add(&(rvm->stats.replay_records), (uint64_t) n);
+    }
+  }
+  pthread_rwlock_unlock(&(rvm->maplock));
+
+  pthread_rwlock_unlock(&(rvm->trunc.resetlock));
+
+  stats_time(&(rvm->stats.map_ns), t);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_MAP, t, (uint64_t) lazy);
+  return segbase;
+}
+
+/*
+  unmap a segment from memory.
+*/
+void rvm_unmap(rvm_t rvm, void *segbase){
+  segment_t seg;
+
+  pthread_rwlock_wrlock(&(rvm->maplock));
+  if ((seg = (segment_t) linprobst_get(&(rvm->segst), (linprobst_key) segbase)) != NULL) {
+    drop_mapping(rvm, seg);
+    lazy_drop(seg);
+
+    /* Committed changes are in the log, so the private pages can go */
+    if (seg->applybase != NULL) {
+      unmap_mmap(seg);
+    }
+  }
+  pthread_rwlock_unlock(&(rvm->maplock));
+}
+
+/*
+  destroy a segment completely, erasing its backing store. This function should not be called on a segment that is currently mapped.
+ */
+void rvm_destroy(rvm_t rvm, const char *segname){
+  segment_t seg;
+  char path[PATH_BUF_SIZE + 1 + SEGNAME_SIZE];
+
+  /* Get file path for segment */
+  get_file_path(rvm, segname, path);
+
+  /* Records for the segment still in its log must not outlive it */
+  rvm_flush(rvm);
+  truncate_pass(rvm, 1, 0, shard_of(rvm, segname));
+
+  pthread_rwlock_wrlock(&(rvm->maplock));
+  if (linprobst_contains(&(rvm->segments), (linprobst_key) segname)) {
+    seg = (segment_t) linprobst_delete(&(rvm->segments), (linprobst_key) segname);
+    snap_detach(seg);
+    lazy_drop(seg);
+    if (seg->applybase != NULL) {
+      drop_mapping(rvm, seg);
+      unmap_mmap(seg);
+    } else {
+      segmem_free(seg);
+    }
+    rangeset_destroy(&(seg->dirty));
+    rangeset_destroy(&(seg->captured));
+    rangeset_destroy(&(seg->delta));
+    track_free(seg);
+    pthread_mutex_destroy(&(seg->snaplock));
+    free(seg);
+  }
+  pthread_rwlock_unlock(&(rvm->maplock));
+
+  /* erase backing store, and any descriptor truncation still holds for it */
+  pthread_mutex_lock(&(rvm->trunc.lock));
+  segfd_drop(rvm, segname);
+  remove(path);
+  pthread_mutex_unlock(&(rvm->trunc.lock));
+}
+
+/*
+  begin a transaction that will modify the segments listed in segbases. If any of the specified segments is already being modified by a transaction, then the call should fail and return (trans_t) -1. Note that trant_t needs to be able to be typecasted to an integer type.
+ */
+trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void **segbases){
+  int i;
+  segment_t seg;
+  trans_t trans;
+  trans_mem_t *mem;
+  uint64_t t = rvm_trace_now();
+
+  /* Reuse the memory of an earlier transaction if there is some */
+  mem = NULL;
+  pthread_mutex_lock(&(rvm->poollock));
+  if (rvm->npool > 0)
+    mem = rvm->pool[--(rvm->npool)];
+  pthread_mutex_unlock(&(rvm->poollock));
+
+  if (mem == NULL) {
+    if ((mem = malloc(sizeof(*mem))) == NULL) {
+      return (trans_t) -1;
+    }
+    arena_init(&(mem->arena), TRANS_ARENA_CHUNK);
+    mem->redocap = TRANS_REDO_INIT;
+    if ((mem->redo = malloc(mem->redocap)) == NULL) {
+      arena_destroy(&(mem->arena));
+      free(mem);
+      return (trans_t) -1;
+    }
+  }
+
+  /* First, set up the transaction structure */
+  trans = (trans_t) arena_alloc(&(mem->arena), sizeof(*trans));
+  trans->rvm = rvm;
+  trans->mem = mem;
+  trans->arena = &(mem->arena);
+  trans->numsegs = numsegs;
+  trans->segments = arena_alloc(trans->arena, numsegs * sizeof(segment_t));
+  trans->savepoints = NULL;
+  trans->modify_calls = 0;
+  trans->undo_bytes = 0;
+
+  /* Add the segments to the transaction, if possible */
+  pthread_rwlock_rdlock(&(rvm->maplock));
+  for (i = 0; i < numsegs; i++) {
+    if ((seg = find_mapping(rvm, segbases[i])) == NULL) {
+      /* Error case: segment not mapped */
+      printf("The segment is not mapped\n");
+      fflush(stdout);
+      break;
+    }
+
+    /*
+     * Claim the segment for this transaction, unless another one is
+     * using it. Threads may race for the same segment.
+     */
+    if (!__sync_bool_compare_and_swap(&(seg->cur_trans), (trans_t) -1, trans)) {
+      printf("There is a current transaction using this segment\n");
+      fflush(stdout);
+      break;
+    }
+    trans->segments[i] = seg;
+  }
+  pthread_rwlock_unlock(&(rvm->maplock));
+
+  /* On failure, give back the segments claimed so far */
+  if (i < numsegs) {
+    trans->numsegs = i;
+    release_trans(trans);
+    return (trans_t) -1;
+  }
+
+  /*
+   * With page tracking, the first write to each page is trapped
+   * instead. Pages still waiting for lazy recovery would lose their
+   * protection, so they are recovered first.
+   */
+  if (rvm->opts.page_tracking) {
+    for (i = 0; i < numsegs; i++) {
+      lazy_finish(trans->segments[i]);
+      track_arm(trans->segments[i]);
+    }
+  }
+
+  __sync_fetch_and_add(&(rvm->stats.begins), 1);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_BEGIN, t, (uint64_t) numsegs);
+  return trans;
+}
+
+/*
+  Gives a snapshot private copies of the pages in a range, with the
+  contents they have now. A write fault on a private mapping makes the
+  kernel copy the page; MADV_POPULATE_WRITE takes those faults without
+  storing anything, and older kernels get each page's first byte
+  written back to it.
+*/
+static void snap_copy_pages(void *arg, size_t offset, size_t size){
+  snapshot_t *s = (snapshot_t *) arg;
+  size_t pagesize = rvm_fault_pagesize();
+  char *base = (char *) s->base + offset;
+  volatile char *p;
+  size_t i;
+
+  mprotect(base, size, PROT_READ | PROT_WRITE);
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(base, size, MADV_POPULATE_WRITE) != 0)
+#endif
+  {
+    for (i = 0; i < size; i += pagesize) {
+      p = (volatile char *) base + i;
+      *p = *p;
+    }
+  }
+  mprotect(base, size, PROT_READ);
+}
+
+/*
+  Called before a range of the segment is first written in a
+  transaction. Snapshots still sharing those pages copy them now.
+  Called with the segment's snapshot lock held.
+*/
+static void snap_keep(segment_t seg, size_t offset, size_t size){
+  size_t start = offset & ~(rvm_fault_pagesize() - 1);
+  snapshot_t *s;
+
+  for (s = seg->snaps; s != NULL; s = s->next)
+    rangeset_add(&(s->kept), start, page_round(offset + size) - start, snap_copy_pages, s);
+}
+
+/*
+  Cuts the segment's snapshots loose before its memory is replaced or
+  freed. Their mappings keep the old memory alive, and since nothing
+  writes it any more they need no further copying. Called with the map
+  lock held for writing.
+*/
+static void snap_detach(segment_t seg){
+  snapshot_t *s;
+
+  pthread_mutex_lock(&(seg->snaplock));
+  for (s = seg->snaps; s != NULL; s = s->next)
+    s->seg = NULL;
+  seg->snaps = NULL;
+  pthread_mutex_unlock(&(seg->snaplock));
+}
+
+const void *rvm_snapshot(rvm_t rvm, void *segbase){
+  size_t pagesize = rvm_fault_pagesize();
+  segment_t seg;
+  snapshot_t *s;
+  mod_t *mod;
+  size_t start;
+
+  pthread_rwlock_rdlock(&(rvm->maplock));
+  if ((seg = find_mapping(rvm, segbase)) == NULL) {
+    pthread_rwlock_unlock(&(rvm->maplock));
+    printf("The segment is not mapped\n");
+    fflush(stdout);
+    return (void *) -1;
+  }
+
+  /* A snapshot shares or copies the pages, so they must hold their data */
+  lazy_finish(seg);
+
+  s = (snapshot_t *) calloc(1, sizeof(*s));
+  s->size = page_round(seg->size);
+  rangeset_init(&(s->kept));
+
+  /* No new undo records can appear while the snapshot lock is held */
+  pthread_mutex_lock(&(seg->snaplock));
+  if (seg->memfd >= 0) {
+    s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, seg->memfd, 0);
+  } else {
+    s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (s->base != MAP_FAILED)
+      memcpy(s->base, seg->segbase, seg->size);
+  }
+
+  if (s->base == MAP_FAILED) {
+    pthread_mutex_unlock(&(seg->snaplock));
+    pthread_rwlock_unlock(&(rvm->maplock));
+    printf("Couldn't map snapshot of %s with error %d\n", seg->segname, errno);
+    fflush(stdout);
+    rangeset_destroy(&(s->kept));
+    free(s);
+    return (void *) -1;
+  }
+
+  /*
+   * A transaction in progress may have changed the segment already.
+   * Its undo records hold the committed contents of everything it
+   * touched, and the bytes around them are not being written.
+   */
+  for (mod = seg->mods; mod != NULL; mod = mod->next) {
+    memcpy((char *) s->base + mod->offset, mod->undo, mod->size);
+    start = mod->offset & ~(pagesize - 1);
+    rangeset_add(&(s->kept), start, page_round(mod->offset + mod->size) - start, NULL, NULL);
+  }
+  mprotect(s->base, s->size, PROT_READ);
+
+  /* Write faults add kept pages without allocating; there can be no more ranges than every other page */
+  rangeset_reserve(&(s->kept), (int) (s->size / pagesize / 2 + 1));
+
+  /* A shared snapshot has to follow the segment's writes; a copy does not */
+  if (seg->memfd >= 0) {
+    s->seg = seg;
+    s->next = seg->snaps;
+    seg->snaps = s;
+  }
+  pthread_mutex_unlock(&(seg->snaplock));
+
+  pthread_mutex_lock(&(rvm->snaplock));
+  linprobst_put(&(rvm->snapshots), (linprobst_key) s->base, (linprobst_value) s);
+  pthread_mutex_unlock(&(rvm->snaplock));
+  pthread_rwlock_unlock(&(rvm->maplock));
+
+  return s->base;
+}
+
+void rvm_snapshot_release(rvm_t rvm, const void *snapbase){
+  snapshot_t *s, **pp;
+
+  pthread_rwlock_rdlock(&(rvm->maplock));
+  pthread_mutex_lock(&(rvm->snaplock));
+  s = (snapshot_t *) linprobst_delete(&(rvm->snapshots), (linprobst_key) snapbase);
+  pthread_mutex_unlock(&(rvm->snaplock));
+
+  if (s == NULL) {
+    pthread_rwlock_unlock(&(rvm->maplock));
+    printf("No snapshot at %p\n", snapbase);
+    fflush(stdout);
+    return;
+  }
+
+  /* Detaching takes the map lock for writing, so s->seg is stable */
+  if (s->seg != NULL) {
+    pthread_mutex_lock(&(s->seg->snaplock));
+    for (pp = &(s->seg->snaps); *pp != s; pp = &((*pp)->next))
+      ;
+    *pp = s->next;
+    pthread_mutex_unlock(&(s->seg->snaplock));
+  }
+  pthread_rwlock_unlock(&(rvm->maplock));
+
+  munmap(s->base, s->size);
+  rangeset_destroy(&(s->kept));
+  free(s);
+}
+
+/*
+  Saves the current contents of a range that no earlier call in this
+  transaction has covered yet. Called with the snapshot lock held.
+*/
+static void capture_undo(void *arg, size_t offset, size_t size){
+  segment_t seg = (segment_t) arg;
+  arena_t *arena = seg->cur_trans->arena;
+  mod_t *mod;
+
+  /* Snapshots take their own copy of the pages before they change */
+  snap_keep(seg, offset, size);
+
+  mod = (mod_t *) arena_alloc(arena, sizeof(mod_t));
+  mod->offset = offset;
+  mod->size = size;
+  mod->undo = arena_alloc(arena, size);
+  memcpy(mod->undo, (char *) seg->segbase + offset, size);
+  seg->cur_trans->undo_bytes += size;
+  mod->next = seg->mods;
+  seg->mods = mod;
+}
+
+/*
+  Marks ranges as written in the current transaction, capturing undo
+  data for them in one go under the snapshot lock. Once the
+  transaction has savepoints, undo records go by the ranges captured
+  since the innermost one, so rolling back to it finds every byte's
+  value as of then; otherwise the dirty set serves for both.
+*/
+static void declare_ranges(segment_t seg, const range_t *ranges, int n){
+  int i;
+
+  pthread_mutex_lock(&(seg->snaplock));
+  track_settle(seg);
+  for (i = 0; i < n; i++) {
+    if (seg->cur_trans->savepoints == NULL) {
+      rangeset_add(&(seg->dirty), ranges[i].offset, ranges[i].size, capture_undo, seg);
+    } else {
+      rangeset_add(&(seg->dirty), ranges[i].offset, ranges[i].size, NULL, NULL);
+      rangeset_add(&(seg->captured), ranges[i].offset, ranges[i].size, capture_undo, seg);
+    }
+  }
+
+  seg->settled = seg->mods;
+  pthread_mutex_unlock(&(seg->snaplock));
+}
+
+static void track_protect(segment_t seg, int prot){
+  if (mprotect(seg->segbase, page_round(seg->size), prot) != 0) {
+    printf("Couldn't protect segment %s with error %d\n", seg->segname, errno);
+    fflush(stdout);
+  }
+}
+
+/*
+  Maps a chunk of undo space for TRACK_CHUNK_PAGES write faults. mmap
+  is a plain system call that takes no lock, so unlike malloc it may
+  be called from the fault handler. Returns NULL if out of memory.
+*/
+static track_chunk_t *track_chunk_map(void){
+  size_t head = page_round(sizeof(track_chunk_t) + TRACK_CHUNK_PAGES * sizeof(mod_t));
+  track_chunk_t *c;
+  char *p;
+
+  p = mmap(NULL, head + TRACK_CHUNK_PAGES * rvm_fault_pagesize(), PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+
+  c = (track_chunk_t *) p;
+  c->next = NULL;
+  c->mods = (mod_t *) (c + 1);
+  c->undo = p + head;
+
+  return c;
+}
+
+static void track_chunk_unmap(track_chunk_t *c){
+  size_t head = page_round(sizeof(track_chunk_t) + TRACK_CHUNK_PAGES * sizeof(mod_t));
+
+  munmap(c, head + TRACK_CHUNK_PAGES * rvm_fault_pagesize());
+}
+
+/* Takes write faults back to the first n of the transaction, reusing the space of the rest */
+static void track_rewind(segment_t seg, int n){
+  track_chunk_t *c = seg->trackchunks;
+  int k;
+
+  for (k = n > 0 ? (n - 1) / TRACK_CHUNK_PAGES : 0; k > 0; k--)
+    c = c->next;
+  seg->trackcur = c;
+  seg->tracknext = n;
+}
+
+/* Unmaps the undo space past the first chunk, once a transaction is over */
+static void track_trim(segment_t seg){
+  track_chunk_t *c, *next;
+
+  if (seg->trackchunks == NULL)
+    return;
+
+  for (c = seg->trackchunks->next; c != NULL; c = next) {
+    next = c->next;
+    track_chunk_unmap(c);
+  }
+  seg->trackchunks->next = NULL;
+  track_rewind(seg, 0);
+}
+
+/* Unmaps all of a segment's undo space, as the segment goes */
+static void track_free(segment_t seg){
+  track_trim(seg);
+  if (seg->trackchunks != NULL)
+    track_chunk_unmap(seg->trackchunks);
+  seg->trackchunks = seg->trackcur = NULL;
+}
+
+/*
+  Adds the pages write faults have captured since the last call to the
+  dirty set, and to the captured set under a savepoint. The fault
+  handler leaves this to the next call that may allocate. Called with
+  the snapshot lock held.
+*/
+static void track_settle(segment_t seg){
+  mod_t *mod;
+
+  for (mod = seg->mods; mod != seg->settled; mod = mod->next) {
+    rangeset_add(&(seg->dirty), mod->offset, mod->size, NULL, NULL);
+    if (seg->cur_trans->savepoints != NULL)
+      rangeset_add(&(seg->captured), mod->offset, mod->size, NULL, NULL);
+  }
+  seg->settled = seg->mods;
+}
+
+/*
+  Write protects a segment of a transaction for page tracking, once it
+  has a chunk of undo space for the fault handler to start on. If not
+  even that can be mapped, the segment stays writable and writes to it
+  have to be declared.
+*/
+static void track_arm(segment_t seg){
+  if (seg->trackchunks == NULL) {
+    if ((seg->trackchunks = track_chunk_map()) == NULL) {
+      printf("Couldn't map undo space to track writes to %s\n", seg->segname);
+      fflush(stdout);
+      return;
+    }
+    track_rewind(seg, 0);
+  }
+
+  track_protect(seg, PROT_READ);
+}
+
+/*
+  Saves the undo image of the page at offset, from the fault handler,
+  in the next free page of the segment's undo space. The whole page is
+  captured, even parts declared already: nothing on it has changed
+  since it was protected, and the older record wins on abort or
+  rollback. The thread that faulted was writing the segment, which it
+  never does with the snapshot lock held. Returns -1 if no undo space
+  is left and none could be mapped.
+*/
+static int track_capture(segment_t seg, size_t offset, size_t size){
+  track_chunk_t *c;
+  mod_t *mod;
+  int i;
+
+  pthread_mutex_lock(&(seg->snaplock));
+
+  /* Move on to the next chunk once this one is used up */
+  c = seg->trackcur;
+  i = seg->tracknext % TRACK_CHUNK_PAGES;
+  if (i == 0 && seg->tracknext > 0) {
+    if (c->next == NULL && (c->next = track_chunk_map()) == NULL) {
+      pthread_mutex_unlock(&(seg->snaplock));
+      return -1;
+    }
+    c = seg->trackcur = c->next;
+  }
+  seg->tracknext++;
+
+  /* Snapshots take their own copy of the page before it changes */
+  snap_keep(seg, offset, size);
+
+  mod = &(c->mods[i]);
+  mod->offset = offset;
+  mod->size = size;
+  mod->undo = c->undo + (size_t) i * rvm_fault_pagesize();
+  memcpy(mod->undo, (char *) seg->segbase + offset, size);
+  mod->next = seg->mods;
+  seg->mods = mod;
+  pthread_mutex_unlock(&(seg->snaplock));
+
+  seg->cur_trans->undo_bytes += size;
+
+  return 0;
+}
+
+/*
+  Write fault handler for page tracking. The first write to a page of
+  a segment in a transaction lands here: the page's undo image is
+  saved, as rvm_about_to_modify would, and it is then opened up so the
+  write can go ahead. Runs in signal context, so it takes no lock the
+  faulting thread may hold and does not call malloc; see track_capture.
+*/
+static int track_fault(void *arg, void *addr){
+  rvm_t rvm = (rvm_t) arg;
+  size_t pagesize = rvm_fault_pagesize();
+  segment_t seg;
+  size_t offset, size;
+
+  seg = fault_mapping(rvm, addr);
+  if (seg == NULL || (long int) seg->cur_trans == -1)
+    return 0;
+
+  offset = ((size_t) ((char *) addr - (char *) seg->segbase)) & ~(pagesize - 1);
+  size = seg->size - offset < pagesize ? seg->size - offset : pagesize;
+
+  if (track_capture(seg, offset, size) != 0)
+    return 0;
+
+  return mprotect((char *) seg->segbase + offset, pagesize, PROT_READ | PROT_WRITE) == 0;
+}
+
+/*
+  Finds the segment segbase points into for a transaction declaring
+  writes to it, and how far into the segment segbase is. Returns NULL
+  after reporting the error if the segment is not part of tid.
+*/
+static segment_t modify_seg(trans_t tid, void *segbase, size_t *base){
+  segment_t seg;
+
+  /* Look up segment data structure by segbase, or by any pointer into it */
+  pthread_rwlock_rdlock(&(tid->rvm->maplock));
+  seg = find_mapping(tid->rvm, segbase);
+  pthread_rwlock_unlock(&(tid->rvm->maplock));
+
+  if (seg == NULL) {
+    printf("Hit error condition:  segment base not part of transaction\n");
+    fflush(stdout);
+    return NULL;
+  }
+  *base = (size_t) ((char *) segbase - (char *) seg->segbase);
+
+  /* Verify that transaction is correct for this segment */
+  /* Just look at the pointer address... is there a reasonable better way? */
+  if (tid != seg->cur_trans) {
+    printf("This segment is not part of the current transaction %p, but instead of %p\n", tid, seg->cur_trans);
+    fflush(stdout);
+    return NULL;
+  }
+
+  return seg;
+}
+
+/*
+  declare that the library is about to modify a specified range of memory in the specified segment. The segment must be one of the segments specified in the call to rvm_begin_trans. Your library needs to ensure that the old memory has been saved, in case an abort is executed. It is legal call rvm_about_to_modify multiple times on the same memory area.
+*/
+void rvm_about_to_modify(trans_t tid, void *segbase, size_t offset, size_t size){
+  segment_t seg;
+  range_t range;
+  size_t base;
+
+  if ((seg = modify_seg(tid, segbase, &base)) == NULL)
+    return;
+  offset += base;
+  tid->modify_calls++;
+
+  if (size > seg->size || offset > seg->size - size) {
+    printf("Range %zu+%zu is outside segment %s\n", offset, size, seg->segname);
+    fflush(stdout);
+    return;
+  }
+
+  /*
+   * Fold the range into the segment's dirty set. Only the parts not
+   * already covered get an undo record, and at commit every dirty
+   * byte is logged exactly once.
+   */
+  range.offset = offset;
+  range.size = size;
+  declare_ranges(seg, &range, 1);
+}
+
+static int range_cmp(const void *a, const void *b){
+  const range_t *x = (const range_t *) a;
+  const range_t *y = (const range_t *) b;
+
+  return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+void rvm_about_to_modify_v(trans_t tid, void *segbase, const range_t *ranges, int n){
+  range_t stackbuf[MODIFY_V_STACK];
+  range_t *sorted;
+  segment_t seg;
+  size_t base, end;
+  int i, m;
+
+  if (n <= 0 || (seg = modify_seg(tid, segbase, &base)) == NULL)
+    return;
+  tid->modify_calls++;
+
+  for (i = 0; i < n; i++) {
+    if (ranges[i].size > seg->size || base + ranges[i].offset > seg->size - ranges[i].size) {
+      printf("Range %zu+%zu is outside segment %s\n", base + ranges[i].offset, ranges[i].size, seg->segname);
+      fflush(stdout);
+      return;
+    }
+  }
+
+  sorted = n <= MODIFY_V_STACK ? stackbuf : (range_t *) malloc(n * sizeof(range_t));
+  if (sorted == NULL) {
+    printf("Couldn't allocate %d ranges for segment %s\n", n, seg->segname);
+    fflush(stdout);
+    return;
+  }
+  memcpy(sorted, ranges, n * sizeof(range_t));
+  qsort(sorted, n, sizeof(range_t), range_cmp);
+
+  /* Merge overlapping and adjacent ranges, so each is declared once */
+  m = 0;
+  for (i = 0; i < n; i++) {
+    if (sorted[i].size == 0)
+      continue;
+    if (m > 0 && sorted[i].offset <= sorted[m - 1].offset + sorted[m - 1].size) {
+      end = sorted[i].offset + sorted[i].size;
+      if (end > sorted[m - 1].offset + sorted[m - 1].size)
+        sorted[m - 1].size = end - sorted[m - 1].offset;
+    } else {
+      sorted[m++] = sorted[i];
+    }
+  }
+  for (i = 0; i < m; i++)
+    sorted[i].offset += base;
+
+  declare_ranges(seg, sorted, m);
+
+  if (sorted != stackbuf)
+    free(sorted);
+}
+
+savepoint_t rvm_savepoint(trans_t tid){
+  savepoint_t sp;
+  segment_t seg;
+  int i;
+
+  sp = (savepoint_t) arena_alloc(tid->arena, sizeof(*sp));
+  sp->mods = (mod_t **) arena_alloc(tid->arena, tid->numsegs * sizeof(mod_t *));
+  sp->tracked = (int *) arena_alloc(tid->arena, tid->numsegs * sizeof(int));
+  for (i = 0; i < tid->numsegs; i++) {
+    seg = tid->segments[i];
+    /* Pages that faulted so far belong with the enclosing savepoint */
+    pthread_mutex_lock(&(seg->snaplock));
+    track_settle(seg);
+    sp->mods[i] = seg->mods;
+    pthread_mutex_unlock(&(seg->snaplock));
+    sp->tracked[i] = seg->tracknext;
+  }
+  sp->prev = tid->savepoints;
+  tid->savepoints = sp;
+
+  /* Undo records added from here on go when the savepoint is rolled back to */
+  arena_mark(tid->arena, &(sp->mark));
+
+  /* From here on every byte first written takes an undo record again */
+  for (i = 0; i < tid->numsegs; i++) {
+    rangeset_clear(&(tid->segments[i]->captured));
+    if (tid->rvm->opts.page_tracking)
+      track_arm(tid->segments[i]);
+  }
+
+  return sp;
+}
+
+void rvm_rollback_to(trans_t tid, savepoint_t sp){
+  savepoint_t p;
+  segment_t seg;
+  mod_t *mod;
+  int i;
+
+  for (p = tid->savepoints; p != NULL && p != sp; p = p->prev)
+    ;
+  if (p == NULL) {
+    printf("Savepoint %p is not part of transaction %p\n", sp, tid);
+    fflush(stdout);
+    return;
+  }
+
+  for (i = 0; i < tid->numsegs; i++) {
+    seg = tid->segments[i];
+
+    /* Ranges declared but never written may still be write protected */
+    if (tid->rvm->opts.page_tracking)
+      track_protect(seg, PROT_READ | PROT_WRITE);
+
+    /* Pop the records taken since the savepoint, newest first */
+    pthread_mutex_lock(&(seg->snaplock));
+    while (seg->mods != sp->mods[i]) {
+      mod = seg->mods;
+      memcpy((char *) seg->segbase + mod->offset, mod->undo, mod->size);
+      seg->mods = mod->next;
+    }
+
+    /*
+     * Every byte written has an undo record, so the ones left are
+     * what is still dirty. Nothing is captured since the savepoint.
+     */
+    rangeset_clear(&(seg->dirty));
+    for (mod = seg->mods; mod != NULL; mod = mod->next)
+      rangeset_add(&(seg->dirty), mod->offset, mod->size, NULL, NULL);
+    rangeset_clear(&(seg->captured));
+    seg->settled = seg->mods;
+    pthread_mutex_unlock(&(seg->snaplock));
+
+    /* The undo space of pages popped above is free for new faults */
+    track_rewind(seg, sp->tracked[i]);
+  }
+
+  tid->savepoints = sp;
+  arena_release(tid->arena, &(sp->mark));
+
+  /* Pages written since the savepoint have to fault again */
+  if (tid->rvm->opts.page_tracking) {
+    for (i = 0; i < tid->numsegs; i++)
+      track_arm(tid->segments[i]);
+  }
+}
+
+/*
+  Ends the transaction: its segments become free for new transactions
+  and everything it allocated goes back to the rvm in one step.
+*/
+static void release_trans(trans_t tid){
+  rvm_t rvm = tid->rvm;
+  trans_mem_t *mem = tid->mem;
+  segment_t seg;
+  int i;
+
+  for (i = 0; i < tid->numsegs; i++) {
+    seg = tid->segments[i];
+    if (rvm->opts.page_tracking)
+      track_protect(seg, PROT_READ | PROT_WRITE);
+    pthread_mutex_lock(&(seg->snaplock));
+    seg->mods = seg->settled = NULL;
+    pthread_mutex_unlock(&(seg->snaplock));
+    rangeset_clear(&(seg->dirty));
+    rangeset_clear(&(seg->captured));
+    rangeset_clear(&(seg->delta));
+    track_trim(seg);
+
+    /* Reset transaction id, after everything above is visible */
+    __sync_synchronize();
+    seg->cur_trans = (trans_t) -1;
+  }
+
+  __sync_fetch_and_add(&(rvm->stats.modify_calls), tid->modify_calls);
+  __sync_fetch_and_add(&(rvm->stats.undo_bytes), tid->undo_bytes);
+  arena_reset(&(mem->arena));
+
+  /* Don't hang on to the buffer of an unusually large commit */
+  if (mem->redocap > TRANS_REDO_KEEP) {
+    free(mem->redo);
+    mem->redocap = TRANS_REDO_INIT;
+    if ((mem->redo = malloc(mem->redocap)) == NULL)
+      mem->redocap = 0;
+  }
+
+  pthread_mutex_lock(&(rvm->poollock));
+  if (rvm->npool == rvm->cappool) {
+    rvm->cappool = rvm->cappool ? 2 * rvm->cappool : 4;
+    rvm->pool = realloc(rvm->pool, rvm->cappool * sizeof(trans_mem_t *));
+  }
+  rvm->pool[rvm->npool++] = mem;
+  pthread_mutex_unlock(&(rvm->poollock));
+}
+
+/*
+  Adds the runs of bytes in [offset, offset + size) that differ from
+  old to the segment's delta set.
+*/
+static void diff_runs(segment_t seg, size_t offset, size_t size, const char *old){
+  const char *cur = (const char *) seg->segbase + offset;
+  size_t i = 0, start;
+
+  while (i < size) {
+    while (size - i >= 8 && memcmp(cur + i, old + i, 8) == 0)
+      i += 8;
+    while (i < size && cur[i] == old[i])
+      i++;
+    if (i == size)
+      break;
+
+    start = i;
+    while (i < size && cur[i] != old[i])
+      i++;
+    rangeset_add(&(seg->delta), offset + start, i - start, NULL, NULL);
+  }
+}
+
+/*
+  Works out what a commit has to log for seg: the bytes that differ
+  from their undo images, rather than every byte declared. A byte with
+  several undo records (one per savepoint it was written under) is
+  logged if it differs from any of them, which includes the oldest.
+  Runs closer together than a record header costs are logged as one.
+*/
+static void seg_delta(segment_t seg){
+  size_t gap = rvm_log_record_size(seg->segname, 0);
+  range_t *r;
+  mod_t *mod;
+  int i, n;
+
+  rangeset_clear(&(seg->delta));
+  for (mod = seg->mods; mod != NULL; mod = mod->next)
+    diff_runs(seg, mod->offset, mod->size, (const char *) mod->undo);
+
+  r = seg->delta.ranges;
+  for (i = 1, n = 0; i < seg->delta.N; i++) {
+    if (r[i].offset - (r[n].offset + r[n].size) <= gap) {
+      r[n].size = r[i].offset + r[i].size - r[n].offset;
+    } else {
+      r[++n] = r[i];
+    }
+  }
+  if (seg->delta.N > 0)
+    seg->delta.N = n + 1;
+}
+
+/*
+commit all changes that have been made within the specified transaction. When the call returns, then enough information should have been saved to disk so that, even if the program crashes, the changes will be seen by the program when it restarts.
+*/
+void rvm_commit_trans(trans_t tid){
+  int i, j, s, nparts;
+  segment_t seg;
+  range_t *r;
+  char *records;
+  size_t len, end, reclen, cap, declared, changed;
+  size_t parts[RVM_SHARDS_MAX];
+  uint64_t mask, xid, t = rvm_trace_now();
+  rvm_t rvm = tid->rvm;
+  int ret = 0;
+
+  /*
+   * Size and encode one redo record per changed run. The records for
+   * each shard's log are framed by begin and commit markers so recovery
+   * applies all or none; a commit spanning several shards also opens
+   * each frame with a cross-shard record naming the others.
+   */
+  len = 0;
+  mask = 0;
+  declared = changed = 0;
+  for (i = 0; i < tid->numsegs; i++) {
+    seg = tid->segments[i];
+    pthread_mutex_lock(&(seg->snaplock));
+    track_settle(seg);
+    pthread_mutex_unlock(&(seg->snaplock));
+    seg_delta(seg);
+    for (j = 0; j < seg->dirty.N; j++)
+      declared += seg->dirty.ranges[j].size;
+    for (j = 0; j < seg->delta.N; j++) {
+      len += rvm_log_record_size(seg->segname, seg->delta.ranges[j].size);
+      changed += seg->delta.ranges[j].size;
+    }
+    if (seg->delta.N > 0)
+      mask |= (uint64_t) 1 << seg->shard;
+  }
+  nparts = __builtin_popcountll(mask);
+  len += nparts * (RVM_LOG_FRAME_OVERHEAD + (nparts > 1 ? RVM_LOG_XSHARD_SIZE : 0));
+
+  /*
+   * Encode into the transaction's redo buffer, which outlives the
+   * transaction and only grows, so steady-state commits allocate
+   * nothing and hand each log one contiguous buffer.
+   */
+  if (len > tid->mem->redocap) {
+    cap = tid->mem->redocap ? tid->mem->redocap : TRANS_REDO_INIT;
+    while (cap < len)
+      cap *= 2;
+    if ((records = realloc(tid->mem->redo, cap)) == NULL) {
+      /* Nothing reaches the log, so memory must not keep the changes either */
+      printf("Failed to grow redo buffer, aborting transaction...\n");
+      fflush(stdout);
+      rvm_abort_trans(tid);
+      return;
+    }
+    tid->mem->redo = records;
+    tid->mem->redocap = cap;
+  }
+  records = tid->mem->redo;
+
+  xid = nparts > 1 ? xshard_begin(rvm) : 0;
+  len = 0;
+  for (s = 0; s < rvm->nshards; s++) {
+    parts[s] = 0;
+    if (!(mask & ((uint64_t) 1 << s)))
+      continue;
+
+    end = len + sizeof(rvm_rec_hdr_t);
+    if (xid != 0)
+      end += rvm_log_encode_xshard(records + end, xid, mask);
+    for (i = 0; i < tid->numsegs; i++) {
+      seg = tid->segments[i];
+      if (seg->shard != s)
+        continue;
+      for (j = 0; j < seg->delta.N; j++) {
+        r = &(seg->delta.ranges[j]);
+        if (rvm->opts.log_compress > 0 && r->size >= (size_t) rvm->opts.log_compress) {
+          reclen = rvm_log_encode_compressed(records + end, seg->segname, r->offset,
+                                             (char *) seg->segbase + r->offset, r->size);
+        } else {
+          reclen = rvm_log_encode_record(records + end, seg->segname, r->offset,
+                                         (char *) seg->segbase + r->offset, r->size);
+        }
+        if (reclen == 0) {
+          printf("Couldn't encode redo record for %s\n", seg->segname);
+          fflush(stdout);
+        }
+        end += reclen;
+      }
+    }
+    parts[s] = rvm_log_seal_frame(records + len, end - len - sizeof(rvm_rec_hdr_t));
+    len += parts[s];
+  }
+
+  __sync_fetch_and_add(&(rvm->stats.declared_bytes), (uint64_t) declared);
+  __sync_fetch_and_add(&(rvm->stats.changed_bytes), (uint64_t) changed);
+  __sync_fetch_and_add(&(rvm->stats.logged_bytes), (uint64_t) len);
+
+  /* Append the frames to the logs, batched with other commits if enabled */
+  if (len > 0 && rvm->opts.group_commit_batch > 0) {
+    ret = group_stage(rvm, records, parts, xid);
+  } else if (len > 0) {
+    for (s = 0; s < rvm->nshards; s++) {
+      if (parts[s] > 0 && log_append(rvm, &(rvm->shards[s]), records, parts[s]) != 0) {
+        printf("Couldn't write redo records with error %d\n", errno);
+        fflush(stdout);
+        ret = -1;
+      }
+      records += parts[s];
+    }
+    if (xid != 0)
+      xshard_done(rvm, xid);
+  }
+
+  /* Recovery will not find a commit that missed its log, so memory must not keep it */
+  if (ret != 0) {
+    printf("Commit did not reach the log, aborting transaction...\n");
+    fflush(stdout);
+    rvm_abort_trans(tid);
+    return;
+  }
+
+  release_trans(tid);
+  __sync_fetch_and_add(&(rvm->stats.commits), 1);
+  stats_time(&(rvm->stats.commit_ns), t);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_COMMIT, t, (uint64_t) len);
+}
+
+/*
+  undo all changes that have happened within the specified transaction.
+ */
+void rvm_abort_trans(trans_t tid){
+  int i;
+  segment_t seg;
+  mod_t *mod;
+  char *data;
+  rvm_t rvm = tid->rvm;
+  uint64_t t = rvm_trace_now(), n = 0;
+
+  /* For all segments that are part of the transaction */
+  for (i = 0; i < tid->numsegs; i++) {
+    seg = tid->segments[i];
+
+    data = (char *) seg->segbase;
+
+    /* Ranges declared but never written may still be write protected */
+    if (rvm->opts.page_tracking)
+      track_protect(seg, PROT_READ | PROT_WRITE);
+
+    /* Apply undo log back to memory, newest first */
+    for (mod = seg->mods; mod != NULL; mod = mod->next) {
+      memcpy(&(data[mod->offset]), mod->undo, mod->size);
+      n++;
+    }
+  }
+
+  release_trans(tid);
+  __sync_fetch_and_add(&(rvm->stats.aborts), 1);
+  rvm_trace_add(&(rvm->trace), RVM_TRACE_ABORT, t, n);
+}
+
+static double now_sec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+  A segment file held open by the truncator.
+*/
+typedef struct segfd_t{
+  char *segname;
+  int fd;
+} segfd_t;
+
+/*
+  Returns an open descriptor for the segment file, from the cache if
+  an earlier pass opened it. Once the cache is full, *owned is set and
+  the caller closes the descriptor after use. Only called with the
+  truncation lock held.
+*/
+static int segfd_get(rvm_t rvm, const char *segname, int *owned){
+  linprobst_t *fds = &(rvm->trunc.fds);
+  char segpath[PATH_BUF_SIZE + 1 + SEGNAME_SIZE];
+  segfd_t *sf;
+  int fd;
+
+  *owned = 0;
+  pthread_mutex_lock(&(rvm->trunc.fdlock));
+  sf = (segfd_t *) linprobst_get(fds, (linprobst_key) segname);
+  pthread_mutex_unlock(&(rvm->trunc.fdlock));
+  if (sf != NULL)
+    return sf->fd;
+
+  get_file_path(rvm, segname, segpath);
+  if ((fd = open(segpath, O_WRONLY)) < 0) {
+    printf("Couldn't get segment file handle for %s with error %d\n", segpath, errno);
+    fflush(stdout);
+    return -1;
+  }
+
+  /* Other workers may be using cached descriptors, so none is evicted here */
+  pthread_mutex_lock(&(rvm->trunc.fdlock));
+  if (linprobst_size(fds) < SEGFD_CACHE_MAX) {
+    sf = (segfd_t *) malloc(sizeof(segfd_t));
+    sf->segname = strdup(segname);
+    sf->fd = fd;
+    linprobst_put(fds, (linprobst_key) sf->segname, (linprobst_value) sf);
+  } else {
+    *owned = 1;
+  }
+  pthread_mutex_unlock(&(rvm->trunc.fdlock));
+
+  return fd;
+}
+
+/*
+  Closes every cached descriptor, so the cache can follow the segments
+  being written now. Only called with the truncation lock held and no
+  apply workers running.
+*/
+static void segfd_flush(rvm_t rvm){
+  linprobst_t *fds = &(rvm->trunc.fds);
+  segfd_t *sf;
+  int i;
+
+  for (i = 0; i < fds->M; i++) {
+    if (fds->keys[i] != NULL) {
+      sf = (segfd_t *) fds->values[i];
+      close(sf->fd);
+      free(sf->segname);
+      free(sf);
+    }
+  }
+  linprobst_destroy(fds);
+  linprobst_init(fds, linprobst_strhash, segname_keyeq);
+}
+
+/*
+  Closes the cached descriptor of a segment file that is going away.
+  Only called with the truncation lock held.
+*/
+static void segfd_drop(rvm_t rvm, const char *segname){
+  segfd_t *sf;
+
+  sf = (segfd_t *) linprobst_delete(&(rvm->trunc.fds), (linprobst_key) segname);
+  if (sf != NULL) {
+    close(sf->fd);
+    free(sf->segname);
+    free(sf);
+  }
+}
+
+/*
+  Writes iovcnt buffers to fd starting at offset, picking up after
+  short writes. Returns 0 on success.
+*/
+static int pwritev_all(int fd, struct iovec *iov, int iovcnt, off_t offset){
+  ssize_t n;
+
+  while (iovcnt > 0) {
+    n = pwritev(fd, iov, iovcnt, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+
+    offset += n;
+    while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Writes one segment's resolved records back to its file. Runs of
+  adjacent records go out as a single pwritev, then the file is synced
+  once.
+*/
+static void writeback_file(rvm_t rvm, rvm_plan_seg_t *ps){
+  struct iovec iov[WRITEBACK_IOV_MAX];
+  uint64_t start, next;
+  int fd, owned, i, n;
+
+  if ((fd = segfd_get(rvm, ps->segname, &owned)) < 0)
+    return;
+
+  for (i = 0; i < ps->N; i += n) {
+    start = next = ps->writes[i].offset;
+    for (n = 0; i + n < ps->N && n < WRITEBACK_IOV_MAX &&
+                ps->writes[i + n].offset == next; n++) {
+      iov[n].iov_base = (void *) ps->writes[i + n].data;
+      iov[n].iov_len = (size_t) ps->writes[i + n].length;
+      next += ps->writes[i + n].length;
+    }
+
+    if (pwritev_all(fd, iov, n, (off_t) start) != 0) {
+      printf("Couldn't write back %llu bytes to segment %s with error %d\n",
+             (unsigned long long) (next - start), ps->segname, errno);
+      fflush(stdout);
+    }
+  }
+
+  __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+  if (fsync(fd) != 0) {
+    printf("Couldn't fsync segment %s with error %d\n", ps->segname, errno);
+    fflush(stdout);
+  }
+  if (owned)
+    close(fd);
+}
+
+/*
+  Writes one segment of a resolved plan back and makes it durable.
+  Segments mapped with mmap take their records through the shared
+  mapping if use_mappings is set; the caller then holds the map lock.
+*/
+static void writeback_seg(rvm_t rvm, rvm_plan_seg_t *ps, int use_mappings){
+  segment_t seg;
+  int j;
+
+  seg = NULL;
+  if (use_mappings) {
+    seg = (segment_t) linprobst_get(&(rvm->segments), (linprobst_key) ps->segname);
+    if (seg != NULL && (seg->applybase == NULL || ps->N == 0 ||
+                        ps->writes[ps->N - 1].offset + ps->writes[ps->N - 1].length >
+                        (uint64_t) seg->size)) {
+      seg = NULL;
+    }
+  }
+
+  if (seg == NULL) {
+    writeback_file(rvm, ps);
+    return;
+  }
+
+  for (j = 0; j < ps->N; j++) {
+    memcpy((char *) seg->applybase + ps->writes[j].offset,
+           ps->writes[j].data, (size_t) ps->writes[j].length);
+  }
+  __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+  if (msync(seg->applybase, seg->size, MS_SYNC) != 0) {
+    printf("Couldn't msync segment %s with error %d\n", seg->segname, errno);
+    fflush(stdout);
+  }
+}
+
+/*
+  Apply worker: takes segments of the plan handed out until none are
+  left, then reports back. Exits once the pool is stopped.
+*/
+static void *apply_worker(void *arg){
+  rvm_t rvm = (rvm_t) arg;
+  rvm_applypool_t *ap = &(rvm->trunc.apply);
+  unsigned long seen = 0;
+  int i;
+
+  pthread_mutex_lock(&(ap->lock));
+  for (;;) {
+    while (ap->gen == seen && !ap->stop)
+      pthread_cond_wait(&(ap->work), &(ap->lock));
+    if (ap->stop)
+      break;
+    seen = ap->gen;
+
+    while (ap->next < ap->plan->nsegs) {
+      i = ap->next++;
+      pthread_mutex_unlock(&(ap->lock));
+      writeback_seg(rvm, ap->plan->segs[i], ap->use_mappings);
+      pthread_mutex_lock(&(ap->lock));
+    }
+
+    if (--(ap->busy) == 0)
+      pthread_cond_signal(&(ap->done));
+  }
+  pthread_mutex_unlock(&(ap->lock));
+
+  return NULL;
+}
+
+/* Sizes the pool; its workers are only started by apply_start */
+static void apply_init(rvm_t rvm){
+  rvm_applypool_t *ap = &(rvm->trunc.apply);
+  long ncpu;
+
+  pthread_mutex_init(&(ap->lock), NULL);
+  pthread_cond_init(&(ap->work), NULL);
+  pthread_cond_init(&(ap->done), NULL);
+
+  ap->nworkers = rvm->opts.recovery_threads;
+  if (ap->nworkers <= 0) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    ap->nworkers = ncpu < 1 ? 1 : (ncpu > APPLY_WORKERS_MAX ? APPLY_WORKERS_MAX : (int) ncpu);
+  }
+}
+
+/*
+  Starts the apply workers, for the first plan of a truncation pass
+  that spans segments. If none can be started, plans are written back
+  inline. Called with the truncation lock held.
+*/
+static void apply_start(rvm_t rvm){
+  rvm_applypool_t *ap = &(rvm->trunc.apply);
+  int i, n;
+
+  ap->workers = (pthread_t *) malloc(ap->nworkers * sizeof(pthread_t));
+  if (ap->workers == NULL)
+    return;
+
+  /* No worker is left from an earlier pass to see these */
+  ap->gen = 0;
+  ap->stop = 0;
+  for (n = 0, i = 0; i < ap->nworkers; i++) {
+    if (pthread_create(&(ap->workers[n]), NULL, apply_worker, rvm) == 0)
+      n++;
+  }
+
+  if (n == 0) {
+    free(ap->workers);
+    ap->workers = NULL;
+  }
+  ap->nworkers = n > 0 ? n : ap->nworkers;
+}
+
+/* Stops and joins the apply workers at the end of a truncation pass, if it started them */
+static void apply_stop(rvm_t rvm){
+  rvm_applypool_t *ap = &(rvm->trunc.apply);
+  int i;
+
+  if (ap->workers == NULL)
+    return;
+
+  pthread_mutex_lock(&(ap->lock));
+  ap->stop = 1;
+  pthread_cond_broadcast(&(ap->work));
+  pthread_mutex_unlock(&(ap->lock));
+
+  for (i = 0; i < ap->nworkers; i++)
+    pthread_join(ap->workers[i], NULL);
+  free(ap->workers);
+  ap->workers = NULL;
+}
+
+/*
+  Writes a resolved plan back to the segments and makes it durable, so
+  the checkpoint can move past it. Segments are independent, so they
+  are spread over the apply workers.
+*/
+static void writeback_plan(rvm_t rvm, rvm_plan_t *plan, int use_mappings){
+  rvm_applypool_t *ap = &(rvm->trunc.apply);
+  int i;
+
+  /* A single worker would only add hand-offs; the caller applies inline */
+  if (ap->workers == NULL && ap->nworkers > 1 && plan->nsegs >= 2)
+    apply_start(rvm);
+
+  if (use_mappings)
+    pthread_rwlock_rdlock(&(rvm->maplock));
+
+  if (ap->workers == NULL || plan->nsegs < 2) {
+    for (i = 0; i < plan->nsegs; i++)
+      writeback_seg(rvm, plan->segs[i], use_mappings);
+  } else {
+    pthread_mutex_lock(&(ap->lock));
+    ap->plan = plan;
+    ap->use_mappings = use_mappings;
+    ap->next = 0;
+    ap->busy = ap->nworkers;
+    ap->gen++;
+    pthread_cond_broadcast(&(ap->work));
+    while (ap->busy > 0)
+      pthread_cond_wait(&(ap->done), &(ap->lock));
+    pthread_mutex_unlock(&(ap->lock));
+  }
+
+  if (use_mappings)
+    pthread_rwlock_unlock(&(rvm->maplock));
+}
+
+/*
+  The checkpoint file holds the first shard's checkpoint, the highest
+  cross-shard commit id known whole, the number of shards, and then the
+  checkpoints of the other shards. One from before shards holds only
+  the first. Writes it from the shards' checkpoints and xid; called
+  with the truncation lock held.
+*/
+static void write_ckpt(rvm_t rvm, uint64_t xid){
+  uint64_t buf[3 + RVM_SHARDS_MAX];
+  size_t n;
+  int i;
+
+  /* Until the parts of incomplete commits are gone, keep the id that found them */
+  if (linprobst_size(&(rvm->xskip)) > 0)
+    xid = rvm->xckpt;
+  rvm->xckpt = xid;
+
+  buf[0] = rvm->shards[0].ckpt;
+  buf[1] = xid;
+  buf[2] = (uint64_t) rvm->nshards;
+  for (i = 1; i < rvm->nshards; i++)
+    buf[2 + i] = rvm->shards[i].ckpt;
+  n = (2 + rvm->nshards) * sizeof(uint64_t);
+
+  __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+  if (pwrite(rvm->trunc.ckptfd, buf, n, 0) != (ssize_t) n ||
+      fdatasync(rvm->trunc.ckptfd) != 0) {
+    printf("Couldn't write checkpoint with error %d\n", errno);
+    fflush(stdout);
+  }
+}
+
+/* Resolves and writes back the records gathered so far, then empties the plan */
+static void plan_flush(rvm_t rvm, int use_mappings, rvm_replay_times_t *times){
+  rvm_plan_t *plan = &(rvm->trunc.plan);
+  double t;
+
+  t = now_sec();
+  rvm_plan_resolve(plan);
+  times->scan_sec += now_sec() - t;
+
+  t = now_sec();
+  writeback_plan(rvm, plan, use_mappings);
+  times->apply_sec += now_sec() - t;
+  times->segments += plan->nsegs;
+
+  rvm_plan_reset(plan);
+}
+
+/*
+  Applies committed records from the checkpoints on to the segment
+  files, at most step bytes of each log (0 for all of it), then moves
+  the checkpoints past them. Logs that are caught up are emptied. only
+  picks a single shard, -1 means all of them. Returns the number of
+  records applied.
+*/
+static long truncate_pass(rvm_t rvm, int use_mappings, uint64_t step, int only){
+  char redopath[REDO_PATH_BUF_SIZE];
+  rvm_plan_t *plan = &(rvm->trunc.plan);
+  uint64_t start[RVM_SHARDS_MAX], limit[RVM_SHARDS_MAX], end[RVM_SHARDS_MAX];
+  uint64_t failed, moved, xid, hole;
+  rvm_shard_t *sh;
+  rvm_replay_times_t times;
+  long count, n;
+  int i;
+  double t;
+  uint64_t t0;
+
+  pthread_mutex_lock(&(rvm->trunc.lock));
+  t0 = rvm_trace_now();
+
+  for (i = 0; i < rvm->nshards; i++) {
+    sh = &(rvm->shards[i]);
+    pthread_mutex_lock(&(sh->loglock));
+    log_drain(sh);
+    start[i] = end[i] = sh->ckpt;
+    limit[i] = (only < 0 || i == only) ? sh->logdone : sh->ckpt;
+    pthread_mutex_unlock(&(sh->loglock));
+
+    if (step > 0 && limit[i] - start[i] > step)
+      limit[i] = start[i] + step;
+  }
+
+  /*
+   * A part of a cross-shard commit below those limits may only be
+   * applied once the other parts are in their logs too, or a crash
+   * could leave the commit half applied.
+   */
+  xid = xshard_settle(rvm);
+
+  /*
+   * Gather the records a plan-full at a time, then write each batch
+   * back segment by segment. Records applied must be on disk before
+   * the checkpoints move past them.
+   */
+  count = 0;
+  failed = 0;
+  memset(&times, 0, sizeof(times));
+  for (i = 0; i < rvm->nshards; i++) {
+    shard_path(rvm, i, redopath);
+    while (end[i] < limit[i]) {
+      t = now_sec();
+      n = rvm_log_replay(redopath, end[i], limit[i], &end[i], rvm_plan_add, plan,
+                         xshard_filter, rvm);
+      times.scan_sec += now_sec() - t;
+      if (n < 0) {
+        printf("Couldn't replay log file with error %d\n", errno);
+        fflush(stdout);
+        failed |= (uint64_t) 1 << i;
+      } else {
+        count += n;
+      }
+
+      if (!plan->full)
+        break;
+      plan_flush(rvm, use_mappings, &times);
+    }
+  }
+  plan_flush(rvm, use_mappings, &times);
+  apply_stop(rvm);
+  times.records = count;
+  if (count > 0) {
+    rvm->trunc.times = times;
+    __sync_fetch_and_add(&(rvm->stats.truncations), 1);
+    __sync_fetch_and_add(&(rvm->stats.replay_records), (uint64_t) count);
+    __sync_fetch_and_add(&(rvm->stats.truncate_scan_ns), (uint64_t) (times.scan_sec * 1e9));
+    __sync_fetch_and_add(&(rvm->stats.truncate_apply_ns), (uint64_t) (times.apply_sec * 1e9));
+  }
+
+  /* Once full, start the descriptor cache over with the next pass's segments */
+  if (linprobst_size(&(rvm->trunc.fds)) >= SEGFD_CACHE_MAX)
+    segfd_flush(rvm);
+
+  moved = 0;
+  for (i = 0; i < rvm->nshards; i++) {
+    if (end[i] > start[i]) {
+      sh = &(rvm->shards[i]);
+      pthread_mutex_lock(&(sh->loglock));
+      sh->ckpt = end[i];
+      pthread_mutex_unlock(&(sh->loglock));
+      moved = 1;
+    }
+  }
+  if (moved)
+    write_ckpt(rvm, xid);
+
+  /*
+   * Give back the space of what was applied and empty the logs that
+   * are caught up. rvm_map may still be reading from behind the new
+   * checkpoints, hence the reset lock.
+   */
+  pthread_rwlock_wrlock(&(rvm->trunc.resetlock));
+  for (i = 0; i < rvm->nshards; i++) {
+    /*
+     * Commits may keep the truncator from ever catching up, so punch
+     * out the applied prefix without moving any offsets. Not every
+     * filesystem can punch holes; that only costs space until the log
+     * is next emptied.
+     */
+    hole = end[i] & ~((uint64_t) LOG_HOLE_ALIGN - 1);
+    if (end[i] > start[i] && hole > LOG_HOLE_ALIGN) {
+      fallocate(rvm->shards[i].redofd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                LOG_HOLE_ALIGN, (off_t) (hole - LOG_HOLE_ALIGN));
+    }
+
+    /*
+     * The log goes before its checkpoint: a checkpoint rewound over a
+     * log whose prefix was punched out would replay into the hole and
+     * drop everything after it, whereas a checkpoint past the end of
+     * an emptied log is simply reset when rvm starts. That only holds
+     * while the log stays empty, so the rewound checkpoint is made
+     * durable before the log lock lets the next append in; otherwise
+     * the stale one would point into the middle of its frame.
+     */
+    sh = &(rvm->shards[i]);
+    if ((only >= 0 && i != only) || (failed & ((uint64_t) 1 << i)))
+      continue;
+
+    /* Nothing stdio still holds may land in the log once it is reset */
+    pthread_mutex_lock(&(sh->loglock));
+    log_drain(sh);
+    if (sh->ckpt == sh->logend && sh->logend > rvm_log_first_record()) {
+      __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+      if (ftruncate(sh->redofd, 0) != 0 || rvm_log_write_header(sh->redofd) != 0 ||
+          fdatasync(sh->redofd) != 0) {
+        printf("Couldn't reset log file with error %d\n", errno);
+        fflush(stdout);
+      } else {
+        sh->ckpt = rvm_log_first_record();
+        write_ckpt(rvm, xid);
+        sh->logepoch++;
+        pthread_cond_broadcast(&(sh->logcond));
+      }
+      log_resync_end(sh);
+    }
+    pthread_mutex_unlock(&(sh->loglock));
+  }
+  pthread_rwlock_unlock(&(rvm->trunc.resetlock));
+
+  if (count > 0)
+    rvm_trace_add(&(rvm->trace), RVM_TRACE_TRUNCATE, t0, (uint64_t) count);
+  pthread_mutex_unlock(&(rvm->trunc.lock));
+
+  return count;
+}
+
+/* Log bytes past the checkpoint in the shard that has the most */
+static uint64_t log_backlog(rvm_t rvm){
+  rvm_shard_t *sh;
+  uint64_t most = 0;
+  int i;
+
+  for (i = 0; i < rvm->nshards; i++) {
+    sh = &(rvm->shards[i]);
+    pthread_mutex_lock(&(sh->loglock));
+    log_drain(sh);
+    if (sh->logdone - sh->ckpt > most)
+      most = sh->logdone - sh->ckpt;
+    pthread_mutex_unlock(&(sh->loglock));
+  }
+
+  return most;
+}
+
+/*
+  Background truncator: sleeps until a log outgrows the threshold,
+  then works through the logs one step at a time.
+*/
+static void *truncator(void *arg){
+  rvm_t rvm = (rvm_t) arg;
+  uint64_t threshold = (uint64_t) rvm->opts.truncate_threshold;
+
+  for (;;) {
+    pthread_mutex_lock(&(rvm->trunc.wakelock));
+    while (log_backlog(rvm) < threshold)
+      pthread_cond_wait(&(rvm->trunc.wake), &(rvm->trunc.wakelock));
+    pthread_mutex_unlock(&(rvm->trunc.wakelock));
+
+    if (truncate_pass(rvm, 0, TRUNCATE_STEP, -1) <= 0) {
+      /* Nothing could be applied; wait for more log before retrying */
+      threshold = log_backlog(rvm) + (uint64_t) rvm->opts.truncate_threshold;
+    } else {
+      threshold = (uint64_t) rvm->opts.truncate_threshold;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+  Loads the checkpoints left by an earlier truncator and opens the
+  logs they belong to, as many as there were then.
+*/
+static void truncator_init(rvm_t rvm){
+  rvm_truncator_t *t = &(rvm->trunc);
+  char ckptpath[REDO_PATH_BUF_SIZE];
+  uint64_t buf[3 + RVM_SHARDS_MAX];
+  ssize_t n;
+  int i;
+
+  pthread_mutex_init(&(t->wakelock), NULL);
+  pthread_cond_init(&(t->wake), NULL);
+  pthread_mutex_init(&(t->lock), NULL);
+  pthread_rwlock_init(&(t->resetlock), NULL);
+  rvm_plan_init(&(t->plan), WRITEBACK_PLAN_MAX);
+  pthread_mutex_init(&(t->fdlock), NULL);
+  linprobst_init(&(t->fds), linprobst_strhash, segname_keyeq);
+  apply_init(rvm);
+
+  strcpy(ckptpath, rvm->prefix);
+  strcat(ckptpath, "/redo.ckpt");
+  t->ckptfd = open(ckptpath, O_RDWR | O_CREAT, 0644);
+
+  if (t->ckptfd < 0) {
+    printf("Couldn't open checkpoint file with error %d\n", errno);
+    fflush(stdout);
+  }
+
+  /* See write_ckpt; whatever is missing reads as zero */
+  memset(buf, 0, sizeof(buf));
+  n = t->ckptfd < 0 ? 0 : pread(t->ckptfd, buf, sizeof(buf), 0);
+  rvm->nshards = 1;
+  if (n >= (ssize_t) (3 * sizeof(uint64_t)) && buf[2] >= 1 && buf[2] <= RVM_SHARDS_MAX)
+    rvm->nshards = (int) buf[2];
+  rvm->xckpt = buf[1];
+
+  rvm->shards = calloc(rvm->nshards, sizeof(rvm_shard_t));
+  shard_open(rvm, 0, buf[0]);
+  for (i = 1; i < rvm->nshards; i++)
+    shard_open(rvm, i, buf[2 + i]);
+}
+
+/*
+ play through any committed or aborted items in the log file(s) and shrink the log file(s) as much as possible.
+*/
+void rvm_truncate_log(rvm_t rvm){
+  /* Staged group commits have to reach the log before it is replayed */
+  rvm_flush(rvm);
+
+  truncate_pass(rvm, 1, 0, -1);
+}
+
+typedef struct compact_t{
+  int fd;           /*The compacted log being written*/
+  uint64_t pos;     /*Where its next frame goes*/
+  char *buf;        /*Room for the begin marker, the frame's records and the commit marker*/
+  size_t cap;
+  size_t payload;   /*Bytes of records in buf so far*/
+  int failed;
+} compact_t;
+
+static void compact_seal(compact_t *c){
+  size_t len;
+
+  if (c->payload == 0)
+    return;
+
+  len = rvm_log_seal_frame(c->buf, c->payload);
+  if (pwrite_all(c->fd, c->buf, len, (off_t) c->pos) != 0)
+    c->failed = 1;
+  c->pos += len;
+  c->payload = 0;
+}
+
+/*
+  Adds one record holding the n writes from w on, which are adjacent
+  in the segment. Frames are cut at about a replay chunk; a record
+  larger than that gets a frame of its own.
+*/
+static void compact_record(compact_t *c, const char *segname, const rvm_plan_write_t *w, int n){
+  uint64_t length = 0;
+  size_t need;
+  char *dst;
+  int i;
+
+  for (i = 0; i < n; i++)
+    length += w[i].length;
+
+  need = rvm_log_record_size(segname, length);
+  if (c->payload > 0 && c->payload + need > RVM_LOG_CHUNK)
+    compact_seal(c);
+
+  if (RVM_LOG_FRAME_OVERHEAD + c->payload + need > c->cap) {
+    c->cap = RVM_LOG_FRAME_OVERHEAD + c->payload + need;
+    if (c->cap < RVM_LOG_CHUNK + RVM_LOG_FRAME_OVERHEAD)
+      c->cap = RVM_LOG_CHUNK + RVM_LOG_FRAME_OVERHEAD;
+    c->buf = realloc(c->buf, c->cap);
+  }
+
+  dst = c->buf + sizeof(rvm_rec_hdr_t) + c->payload;
+  dst += rvm_log_encode_header(dst, segname, w[0].offset, length);
+  for (i = 0; i < n; i++) {
+    memcpy(dst, w[i].data, (size_t) w[i].length);
+    dst += w[i].length;
+  }
+  c->payload += need;
+}
+
+/* Writes a resolved plan out as records, merging writes that touch */
+static void compact_plan(compact_t *c, rvm_plan_t *plan){
+  rvm_plan_seg_t *ps;
+  int i, j, k;
+
+  for (i = 0; i < plan->nsegs; i++) {
+    ps = plan->segs[i];
+    for (j = 0; j < ps->N; j = k) {
+      for (k = j + 1; k < ps->N; k++) {
+        if (ps->writes[k].offset != ps->writes[k - 1].offset + ps->writes[k - 1].length)
+          break;
+      }
+      compact_record(c, ps->segname, &(ps->writes[j]), k - j);
     }
+  }
+}
+
+/*
+  Copies the log bytes [start, end) of fd to the compacted log as they
+  are. They are whole frames, which do not care where they sit.
+*/
+static void compact_copy(compact_t *c, int fd, uint64_t start, uint64_t end){
+  char *buf;
+  ssize_t n;
+
+  buf = malloc(RVM_LOG_CHUNK);
+  while (start < end && !c->failed) {
+    n = pread(fd, buf, end - start < RVM_LOG_CHUNK ? (size_t) (end - start) : RVM_LOG_CHUNK,
+              (off_t) start);
+    if (n <= 0 || pwrite_all(c->fd, buf, (size_t) n, (off_t) c->pos) != 0) {
+      c->failed = 1;
+      break;
+    }
+    start += (uint64_t) n;
+    c->pos += (uint64_t) n;
+  }
+  free(buf);
+}
 
-    ret = fclose(segfile);
+/*
+  Compacts the records [start, limit) of shard i into a new log, then
+  swaps it in along with whatever was appended meanwhile. Called with
+  the truncation lock held.
+*/
+static void compact_shard(rvm_t rvm, int i, uint64_t start, uint64_t limit){
+  char redopath[REDO_PATH_BUF_SIZE], tmppath[REDO_PATH_BUF_SIZE];
+  rvm_plan_t *plan = &(rvm->trunc.plan);
+  rvm_shard_t *sh = &(rvm->shards[i]);
+  uint64_t end, tail;
+  compact_t c;
+  struct stat st;
+  int full, oldfd, fd, dirfd, flags;
+
+  shard_path(rvm, i, redopath);
+  strcpy(tmppath, redopath);
+  strcat(tmppath, ".compact");
+
+  memset(&c, 0, sizeof(c));
+  c.pos = start;
+  c.fd = open(tmppath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  oldfd = open(redopath, O_RDONLY);
+  if (c.fd < 0 || oldfd < 0 || rvm_log_write_header(c.fd) != 0) {
+    printf("Couldn't create compacted log with error %d\n", errno);
+    fflush(stdout);
+    c.failed = 1;
+  }
 
-    if (ret != 0) {
-      printf("Couldn't close segfile ith error %d\n", errno);
+  /* Batches are folded separately, but replay keeps them in order */
+  end = start;
+  while (!c.failed && end < limit) {
+    if (rvm_log_replay(redopath, end, limit, &end, rvm_plan_add, plan, xshard_filter, rvm) < 0)
+      c.failed = 1;
+    rvm_plan_resolve(plan);
+    compact_plan(&c, plan);
+    compact_seal(&c);
+
+    full = plan->full;
+    rvm_plan_reset(plan);
+    if (!full)
+      break;
+  }
+
+  /* A torn or corrupt record, or nothing to gain: keep the log as it is */
+  if (end != limit || c.pos - start >= limit - start)
+    c.failed = 1;
+
+  if (!c.failed) {
+    pthread_rwlock_wrlock(&(rvm->trunc.resetlock));
+    pthread_mutex_lock(&(sh->loglock));
+
+    /* Appends reserved so far have to land before their bytes are copied */
+    log_drain(sh);
+    while (sh->logdone < sh->logend && sh->logfailed == 0)
+      pthread_cond_wait(&(sh->logcond), &(sh->loglock));
+
+    tail = fstat(sh->redofd, &st) == 0 ? (uint64_t) st.st_size : sh->logend;
+    if (sh->logfailed == 0)
+      compact_copy(&c, oldfd, limit, tail);
+
+    flags = O_WRONLY;
+    if (rvm->opts.durability == RVM_DURABLE_DSYNC)
+      flags |= O_DSYNC;
+
+    if (sh->logfailed != 0) {
+      /* Copying the hole a failed append left would pass it off as written */
+      c.failed = 1;
+    } else if (c.failed || fdatasync(c.fd) != 0 || rename(tmppath, redopath) != 0 ||
+               (fd = open(redopath, flags)) < 0) {
+      printf("Couldn't replace log file with error %d\n", errno);
       fflush(stdout);
+      c.failed = 1;
+    } else {
+      __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+
+      /* The rename itself has to be durable before the old records are gone for good */
+      if ((dirfd = open(rvm->prefix, O_RDONLY)) >= 0) {
+        __sync_fetch_and_add(&(rvm->stats.syncs), 1);
+        fsync(dirfd);
+        close(dirfd);
+      }
+
+      dup2(fd, sh->redofd);
+      close(fd);
+      if (sh->redof != NULL) {
+        fclose(sh->redof);
+        sh->redof = fdopen(dup(sh->redofd), "a");
+        setvbuf(sh->redof, NULL, _IOFBF, 1 << 20);
+      }
+
+      /* Every record in the new log is durable already */
+      log_resync_end(sh);
+      sh->logsynced = sh->logend;
+      sh->logepoch++;
+      pthread_cond_broadcast(&(sh->logcond));
     }
+
+    pthread_mutex_unlock(&(sh->loglock));
+    pthread_rwlock_unlock(&(rvm->trunc.resetlock));
+  }
+
+  if (c.fd >= 0)
+    close(c.fd);
+  if (oldfd >= 0)
+    close(oldfd);
+  if (c.failed)
+    unlink(tmppath);
+  free(c.buf);
+}
+
+/*
+  Rewrites the records the truncator has not applied yet so that each
+  byte is logged once, with its newest committed value. The records
+  are folded into a new log a plan-full at a time, at the same offset
+  as before; the applied prefix is left a hole, so the checkpoint stays
+  valid for either log. Commits keep going meanwhile and are copied
+  over as they are once appends are briefly held off, and the new log
+  then replaces the old one with a rename. Each shard's log is
+  compacted in turn.
+*/
+void rvm_compact_log(rvm_t rvm){
+  uint64_t start[RVM_SHARDS_MAX], limit[RVM_SHARDS_MAX], xid;
+  rvm_shard_t *sh;
+  int i, any = 0;
+
+  rvm_flush(rvm);
+
+  pthread_mutex_lock(&(rvm->trunc.lock));
+
+  for (i = 0; i < rvm->nshards; i++) {
+    sh = &(rvm->shards[i]);
+    pthread_mutex_lock(&(sh->loglock));
+    start[i] = sh->ckpt;
+    limit[i] = sh->logdone;
+    pthread_mutex_unlock(&(sh->loglock));
+    if (start[i] < limit[i])
+      any = 1;
+  }
+
+  /*
+   * Folding drops the cross-shard records, so recovery has to know the
+   * commits below the limits are whole before any log is replaced.
+   */
+  if (any) {
+    xid = xshard_settle(rvm);
+    write_ckpt(rvm, xid);
+  }
+
+  for (i = 0; i < rvm->nshards; i++) {
+    if (start[i] < limit[i])
+      compact_shard(rvm, i, start[i], limit[i]);
+  }
+
+  pthread_mutex_unlock(&(rvm->trunc.lock));
+}
+
+void rvm_redo_stats(rvm_t rvm, rvm_redo_stats_t *stats){
+  stats->declared_bytes = __sync_fetch_and_add(&(rvm->stats.declared_bytes), 0);
+  stats->changed_bytes = __sync_fetch_and_add(&(rvm->stats.changed_bytes), 0);
+  stats->logged_bytes = __sync_fetch_and_add(&(rvm->stats.logged_bytes), 0);
+}
+
+void rvm_stats(rvm_t rvm, rvm_stats_t *stats){
+  uint64_t *in = (uint64_t *) &(rvm->stats), *out = (uint64_t *) stats;
+  rvm_shard_t *sh;
+  size_t i;
+  int s;
+
+  /* Every field is a uint64_t counter, so they can be read in one sweep */
+  for (i = 0; i < sizeof(rvm_stats_t) / sizeof(uint64_t); i++)
+    out[i] = __sync_fetch_and_add(&(in[i]), 0);
+
+  /* A transaction ending while the counters are read may be counted as ended but not begun */
+  stats->active_trans = stats->begins - stats->commits - stats->aborts;
+  if (stats->commits + stats->aborts > stats->begins)
+    stats->active_trans = 0;
+
+  stats->log_bytes = 0;
+  for (s = 0; s < rvm->nshards; s++) {
+    sh = &(rvm->shards[s]);
+    pthread_mutex_lock(&(sh->loglock));
+    stats->log_bytes += sh->logdone - sh->ckpt;
+    pthread_mutex_unlock(&(sh->loglock));
+  }
+}
+
+size_t rvm_read_trace(rvm_t rvm, rvm_trace_event_t *events, size_t max){
+  return rvm_trace_read(&(rvm->trace), events, max);
+}
+
+void rvm_dump_trace(rvm_t rvm, FILE *out){
+  rvm_trace_event_t *events;
+  size_t i, n;
+
+  if (rvm->trace.ring == NULL)
+    return;
+
+  events = malloc((rvm->trace.mask + 1) * sizeof(rvm_trace_event_t));
+  if (events == NULL)
+    return;
+
+  n = rvm_trace_read(&(rvm->trace), events, rvm->trace.mask + 1);
+  for (i = 0; i < n; i++) {
+    fprintf(out, "%llu %llu.%09llu +%lluns %s %llu thread %u\n",
+            (unsigned long long) events[i].seq,
+            (unsigned long long) (events[i].start_ns / 1000000000ull),
+            (unsigned long long) (events[i].start_ns % 1000000000ull),
+            (unsigned long long) events[i].dur_ns,
+            rvm_trace_name(events[i].type),
+            (unsigned long long) events[i].arg, events[i].thread);
   }
+  fflush(out);
+  free(events);
+}
 
-  /* Clear out log file and close it out */
-  ret = fclose(logfile);
-  logfile = fopen(redopath, "w");
-  fclose(logfile);
+void rvm_replay_times(rvm_t rvm, rvm_replay_times_t *times){
+  pthread_mutex_lock(&(rvm->trunc.lock));
+  *times = rvm->trunc.times;
+  pthread_mutex_unlock(&(rvm->trunc.lock));
 }
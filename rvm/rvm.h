@@ -1,60 +1,291 @@
 #ifndef RVM_H
 #define RVM_H
 
-#include "steque.h"
-#include "seqsrchst.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "linprobst.h"
+#include "rangeset.h"
+#include "rvm_plan.h"
+#include "rvm_trace.h"
 
 /*For undo and redo logs*/
 typedef struct mod_t{
-  int offset;
-  int size;
+  size_t offset;
+  size_t size;
   void *undo;
+  struct mod_t *next;
 } mod_t;
 
 typedef struct _segment_t* segment_t;
-typedef struct _redo_t* redo_t;
+
+/*Undo space that write faults take pages from, mapped a chunk at a time*/
+typedef struct track_chunk_t{
+  struct track_chunk_t *next;
+  mod_t *mods;        /*An undo record per page of the chunk*/
+  char *undo;         /*And a page image for each*/
+} track_chunk_t;
+
+/*A read-only point-in-time view of a segment, see rvm_snapshot*/
+typedef struct snapshot_t{
+  void *base;
+  size_t size;
+  segment_t seg;      /*Segment whose writes it must keep out, NULL once it no longer shares memory*/
+  rangeset_t kept;    /*Pages with a private copy of the snapshot time contents*/
+  struct snapshot_t *next;
+} snapshot_t;
 
 typedef struct _trans_t* trans_t;
+typedef struct _savepoint_t* savepoint_t;
 typedef struct _rvm_t* rvm_t;
-typedef struct segentry_t segentry_t;
+
+/*Log records a lazily mapped segment has yet to apply, see lazy_recovery*/
+typedef struct rvm_lazy_t{
+  rvm_t rvm;
+  segment_t seg;
+  uint64_t start, end;        /*Part of the log the records are in*/
+  pthread_t scanner;          /*Gathers the segment's records from its log*/
+  pthread_mutex_t lock;       /*Guards started and joined*/
+  pthread_cond_t cond;        /*Signalled once the scanner holds the reset lock*/
+  int started;
+  int joined;
+  volatile int ready;         /*Set once plan holds every record to apply*/
+  rvm_plan_t plan;
+  rvm_plan_seg_t *ps;         /*The segment's writes in plan, NULL if it has none*/
+  char *view;                 /*Second shared mapping of the segment that pages are recovered through*/
+  int ownview;                /*Whether view is ours to unmap*/
+  volatile unsigned char *pages; /*Per page: LAZY_PENDING, LAZY_APPLYING or LAZY_DONE*/
+  size_t npages;
+  volatile size_t left;       /*Pages not yet done*/
+} rvm_lazy_t;
 
 struct _segment_t{
   char segname[128];
   void *segbase;
-  int size;
+  size_t size;
   trans_t cur_trans;
-  steque_t mods;
+  mod_t *mods;        /*Undo records, newest first; each byte captured at most once per savepoint, bar write faults*/
+  rangeset_t dirty;   /*Coalesced ranges declared in the current transaction, for redo*/
+  rangeset_t captured; /*Ranges with an undo record since the innermost savepoint*/
+  rangeset_t delta;   /*Changed runs of the dirty ranges, worked out at commit*/
+  void *applybase;    /*Shared mapping of the segment file that truncation writes through, if mmap'ed*/
+  int memfd;          /*Memory file behind a malloc'ed segment, -1 if mmap'ed*/
+  pthread_mutex_t snaplock; /*Guards mods and snaps between the transaction and snapshot takers*/
+  snapshot_t *snaps;  /*Snapshots sharing the segment's memory*/
+  int shard;          /*Log shard holding the segment's records*/
+  rvm_lazy_t *lazy;   /*Recovery still pending on first touch, NULL if none*/
+  track_chunk_t *trackchunks; /*Undo space for write faults, oldest first; the first is kept between transactions*/
+  track_chunk_t *trackcur;    /*Chunk the latest write fault took its page from*/
+  int tracknext;      /*Pages taken by write faults in the transaction so far*/
+  mod_t *settled;     /*Newest undo record already in dirty and captured; newer ones are from write faults*/
 };
 
+/*Memory of a transaction, handed on to a later transaction when it ends*/
+typedef struct trans_mem_t{
+  arena_t arena;      /*Undo data and bookkeeping*/
+  char *redo;         /*Redo records, encoded at commit and written with one append*/
+  size_t redocap;
+} trans_mem_t;
+
 struct _trans_t{
   rvm_t rvm;          /*The rvm to which the transaction belongs*/
+  trans_mem_t *mem;
+  arena_t *arena;     /*Holds this structure and all of the transaction's undo data*/
   int numsegs;        /*The number of segments involved in the transaction*/
   segment_t* segments;/*The array of segments*/
+  savepoint_t savepoints; /*Innermost savepoint, NULL if none*/
+  uint64_t modify_calls; /*Counted here and added to the rvm's stats when the transaction ends*/
+  uint64_t undo_bytes;
 };
 
-/*For redo*/
-struct segentry_t{
-  char segname[128];
-  int segsize;
-  int updatesize;
-  int numupdates;
-  int* offsets;
-  int* sizes;
-  void *data;
+/*A point in a transaction that it can be rolled back to*/
+struct _savepoint_t{
+  mod_t **mods;       /*Newest undo record of each segment when the savepoint was set*/
+  int *tracked;       /*Pages write faults had taken of each segment by then*/
+  arena_mark_t mark;  /*Arena position just past the savepoint itself*/
+  savepoint_t prev;   /*Enclosing savepoint*/
 };
 
-/*The redo log */
-struct _redo_t{
-  int numentries;
-  segentry_t* entries;
-};
+/* How far a commit pushes its log records before returning */
+typedef enum rvm_durability_t{
+  RVM_DURABLE_DEFAULT = 0,    /*Same as RVM_DURABLE_FDATASYNC*/
+  RVM_DURABLE_NONE,           /*Buffered in the process, written out by rvm_flush or when full*/
+  RVM_DURABLE_FLUSH,          /*Handed to the OS: survives a process crash, not a power loss*/
+  RVM_DURABLE_FDATASYNC,      /*Written and fdatasync'ed before the commit returns*/
+  RVM_DURABLE_DSYNC           /*Log opened O_DSYNC, so every log write is synchronous*/
+} rvm_durability_t;
+
+/* Tuning knobs, see rvm_init_opts */
+typedef struct rvm_options_t{
+  rvm_durability_t durability;
+  int group_commit_batch;     /*Commits per log append and sync; 0 disables group commit*/
+  int group_commit_delay_us;  /*Longest a staged commit waits for its batch to fill*/
+  int group_commit_async;     /*If set, commits return once staged instead of once durable*/
+  int mmap_segments;          /*Demand page segments from their files instead of reading them in*/
+  long truncate_threshold;    /*Log bytes past the checkpoint that wake the background truncator*/
+  int page_tracking;          /*Trap the first write to each page instead of requiring rvm_about_to_modify*/
+  int recovery_threads;       /*Workers writing segments back during replay; 0 for one per CPU*/
+  long log_compress;          /*Compress redo records of at least this many bytes; 0 never does*/
+  int log_shards;             /*Redo logs segments are hashed over; 0 or 1 for a single log*/
+  int lazy_recovery;          /*rvm_map returns at once and pending records reach each page on first touch*/
+  long trace_events;          /*Recent events kept for rvm_read_trace; 0 turns tracing off*/
+} rvm_options_t;
+
+/* Most redo log shards, so a commit's shards fit in a 64-bit mask */
+#define RVM_SHARDS_MAX (64)
 
+/*One redo log; every record of a segment goes to the same one*/
+typedef struct rvm_shard_t{
+  int redofd;         /*File descriptor for the log*/
+  FILE *redof;        /*Buffered stream on the log for RVM_DURABLE_NONE*/
+  pthread_mutex_t loglock; /*Guards the log offsets below and the checkpoint*/
+  pthread_cond_t logcond;  /*Broadcast when logdone or logsynced moves*/
+  uint64_t logend;    /*End of the space handed out to appends so far*/
+  uint64_t logdone;   /*Every byte before this has been written*/
+  uint64_t logsynced; /*Every byte before this has been fdatasync'ed*/
+  int logsyncing;     /*Set while some appender runs fdatasync for everyone*/
+  uint64_t logepoch;  /*Bumped when the log is emptied or compacted, which renumbers its offsets*/
+  rangeset_t logwritten; /*Written byte ranges of the log; the first one ends at logdone*/
+  uint64_t logfailed; /*Start of the first append that could not be written, 0 if none*/
+  uint64_t ckpt;      /*Log offset of the first record not yet applied to the segment files*/
+} rvm_shard_t;
+
+/*Records staged for the next group commit append, per shard*/
+typedef struct rvm_batch_t{
+  char **bufs;
+  size_t *lens;
+  size_t *caps;
+  uint64_t *xids;             /*Cross-shard commits in the batch*/
+  int nxids;
+  int capxids;
+} rvm_batch_t;
+
+/*Group commit state: commits staged for the next log append*/
+typedef struct rvm_group_t{
+  pthread_mutex_t lock;
+  pthread_cond_t staged;      /*Signalled when the flusher has work to do*/
+  pthread_cond_t durable;     /*Broadcast when a batch is taken and when it reaches the log*/
+  pthread_t flusher;
+  rvm_batch_t *batch;         /*Records of the batch being staged*/
+  rvm_batch_t *spare;         /*Swapped in while a batch is written*/
+  int count;                  /*Commits in the batch being staged*/
+  uint64_t staged_seq;        /*Sequence number of the last staged commit*/
+  uint64_t durable_seq;       /*Sequence number of the last commit written*/
+  rangeset_t failed;          /*Sequence numbers of commits whose batch could not be written*/
+  struct timespec first;      /*When the first commit of the batch was staged*/
+  int flush_req;
+} rvm_group_t;
+
+/*Workers that write the segments of a replayed plan back in parallel, for the length of a truncation pass*/
+typedef struct rvm_applypool_t{
+  pthread_t *workers;         /*NULL until a plan of the pass spans segments*/
+  int nworkers;
+  pthread_mutex_t lock;
+  pthread_cond_t work;        /*Broadcast when a plan is handed out*/
+  pthread_cond_t done;        /*Signalled when the last worker is through with it*/
+  rvm_plan_t *plan;           /*Plan being written back*/
+  int use_mappings;
+  int next;                   /*Next segment of the plan to hand out*/
+  int busy;                   /*Workers not yet through with the plan*/
+  unsigned long gen;          /*Bumped for every plan handed out*/
+  int stop;                   /*Set to have the workers exit*/
+} rvm_applypool_t;
+
+/* Timings of the most recent truncation pass, see rvm_replay_times */
+typedef struct rvm_replay_times_t{
+  double scan_sec;            /*Reading the log and sorting its records by segment*/
+  double apply_sec;           /*Writing the segments back and syncing them*/
+  long records;               /*Records replayed*/
+  int segments;               /*Segments written back*/
+} rvm_replay_times_t;
+
+/* Redo volume since rvm_init, see rvm_redo_stats */
+typedef struct rvm_redo_stats_t{
+  uint64_t declared_bytes;    /*Bytes declared modified by committed transactions*/
+  uint64_t changed_bytes;     /*Bytes of those put in redo records after diffing*/
+  uint64_t logged_bytes;      /*Bytes appended to the log, after compression and with headers*/
+} rvm_redo_stats_t;
+
+/* Counters since rvm_init, see rvm_stats */
+typedef struct rvm_stats_t{
+  uint64_t begins;            /*Transactions begun*/
+  uint64_t commits;           /*Transactions committed*/
+  uint64_t aborts;            /*Transactions aborted*/
+  uint64_t active_trans;      /*Transactions begun and not yet ended*/
+  uint64_t modify_calls;      /*Calls to rvm_about_to_modify and rvm_about_to_modify_v*/
+  uint64_t undo_bytes;        /*Bytes of undo images saved, declared or trapped*/
+  uint64_t declared_bytes;    /*As in rvm_redo_stats_t*/
+  uint64_t changed_bytes;
+  uint64_t logged_bytes;
+  uint64_t log_writes;        /*Appends to the logs*/
+  uint64_t syncs;             /*fdatasync, fsync and msync calls on logs, segments and checkpoints*/
+  uint64_t log_bytes;         /*Log bytes not yet truncated, over all shards*/
+  uint64_t truncations;       /*Truncation passes that applied records*/
+  uint64_t replay_records;    /*Records applied to segments by truncation and recovery*/
+  uint64_t commit_ns;         /*Time spent in rvm_commit_trans*/
+  uint64_t log_write_ns;      /*Time spent writing logs*/
+  uint64_t log_sync_ns;       /*Time spent syncing logs*/
+  uint64_t truncate_scan_ns;  /*Time truncation spent reading logs*/
+  uint64_t truncate_apply_ns; /*Time truncation spent writing segments back*/
+  uint64_t map_ns;            /*Time spent in rvm_map*/
+} rvm_stats_t;
+
+/*Background truncation state*/
+typedef struct rvm_truncator_t{
+  pthread_t worker;
+  pthread_mutex_t wakelock;   /*Held by the truncator while it checks the logs and waits*/
+  pthread_cond_t wake;        /*Signalled, under wakelock, when a log passes the threshold*/
+  pthread_mutex_t lock;       /*Serializes truncation passes*/
+  pthread_rwlock_t resetlock; /*Held shared by rvm_map while it reads a log, exclusive to reset one*/
+  int ckptfd;                 /*File holding the checkpoints of the shards*/
+  rvm_plan_t plan;            /*Records of the batch being written back*/
+  pthread_mutex_t fdlock;     /*Guards fds between apply workers*/
+  linprobst_t fds;            /*Open segment files by name, kept across passes*/
+  rvm_applypool_t apply;
+  rvm_replay_times_t times;
+} rvm_truncator_t;
+
+/*
+ * Mapped segments sorted by base pointer. Replaced whole on every
+ * change, never edited in place, so fault handlers can search it
+ * without taking the map lock.
+ */
+typedef struct rvm_segidx_t{
+  int n;
+  segment_t segs[];
+} rvm_segidx_t;
 
 /* rvm */
 struct _rvm_t{
   char prefix[128];   /*The path to the directory holding the segments*/
-  int redofd;         /*File descriptor for the redo-log*/
-  seqsrchst_t segst;  /*A sequential search dictionary mapping base pointers to segment names*/ 
+  rvm_shard_t *shards; /*Redo logs*/
+  int nshards;
+  pthread_mutex_t xlock; /*Guards the cross-shard commit ids below*/
+  pthread_cond_t xcond;  /*Broadcast when a cross-shard commit is wholly in the logs*/
+  uint64_t xnext;     /*Id of the next commit spanning several shards*/
+  rangeset_t xdone;   /*Ids of cross-shard commits with every part in the logs; the first range starts at 0*/
+  linprobst_t xskip;  /*Ids of cross-shard commits a crash left with parts missing*/
+  uint64_t xckpt;     /*Cross-shard id stored with the checkpoints; every commit up to it is whole*/
+  pthread_rwlock_t maplock; /*Guards segments and segst, and serializes changes to segidx*/
+  linprobst_t segments; /*Segments known to this rvm, by name*/
+  linprobst_t segst;  /*Mapped segments, by base pointer*/
+  rvm_segidx_t *segidx; /*Mapped segments sorted by base pointer, to resolve interior pointers*/
+  int segidx_readers; /*Fault handlers reading segidx without the map lock*/
+  pthread_mutex_t poollock; /*Guards the pool of transaction memory*/
+  trans_mem_t **pool; /*Memory of finished transactions, kept for reuse*/
+  int npool;
+  int cappool;
+  pthread_mutex_t snaplock; /*Guards snapshots*/
+  linprobst_t snapshots; /*Live snapshots, by base pointer*/
+  rvm_options_t opts;
+  rvm_stats_t stats;  /*Updated atomically; active_trans and log_bytes are worked out on demand*/
+  rvm_trace_t trace;
+  rvm_group_t group;
+  rvm_truncator_t trunc;
 };
 
 
@@ -63,6 +294,121 @@ struct _rvm_t{
  */
 rvm_t rvm_init(const char *directory);
 
+/*
+ * Like rvm_init, but with explicit tuning options. Passing NULL is
+ * the same as rvm_init.
+ *
+ * durability trades commit latency for safety; the default is to
+ * fdatasync the log before rvm_commit_trans returns.
+ *
+ * With group_commit_batch > 0, commits are staged in memory and
+ * written to the log together, with one append and one sync per
+ * batch. A batch goes out once it holds group_commit_batch commits or
+ * its oldest commit has waited group_commit_delay_us, and never holds
+ * more: a commit arriving at a full batch waits until the batch is
+ * being written and stages in the next one. Normally
+ * rvm_commit_trans still waits until its batch is on disk, so
+ * concurrent committers share a flush. With group_commit_async set it
+ * returns as soon as the commit is staged, which also batches
+ * back-to-back commits from one thread at the cost of losing up to
+ * one batch on a crash.
+ *
+ * With mmap_segments set, rvm_map maps the segment file privately
+ * (copy-on-write) instead of reading it into malloc'ed memory, so
+ * mapping is O(1) and only touched pages take up memory. Writes stay
+ * private to the process until they are committed and truncated.
+ *
+ * With truncate_threshold > 0, truncation moves to a background
+ * thread that wakes whenever the log holds that many bytes past the
+ * last checkpoint. It applies committed records to the segment files
+ * a few megabytes at a time, recording its progress in a checkpoint
+ * file, and empties the log once it has caught up. rvm_map then no
+ * longer truncates; it reads the segment and overlays any records the
+ * truncator has not applied yet.
+ *
+ * With page_tracking set, the segments of a transaction are write
+ * protected from rvm_begin_trans until it ends. The first write to
+ * each page traps and the page's undo image is saved then, so
+ * rvm_about_to_modify becomes optional. It still works, and saves
+ * only the declared bytes. Memory a system
+ * call writes into is not trapped (the call fails with EFAULT), so
+ * touch such buffers from user code first or declare them.
+ *
+ * Log replay first scans the log and sorts its records by segment,
+ * then writes the segments back on recovery_threads workers at once
+ * (by default one per CPU, at most eight).
+ *
+ * Commits only log the bytes that differ from their undo images, so a
+ * large declared range with a few edits costs a few small records.
+ * With log_compress > 0, records of at least that many bytes are also
+ * compressed when that makes them smaller. rvm_redo_stats tells how
+ * much either saves.
+ *
+ * With log_shards > 1, segments are hashed over that many redo logs
+ * (at most RVM_SHARDS_MAX), each with its own lock, sync and
+ * checkpoint, so commits to different segments do not queue on one
+ * log, and mapping a segment only replays its own log. A transaction
+ * spanning several logs leaves a part in each; recovery drops all of
+ * them if a crash kept any from reaching its log. Changing log_shards
+ * applies and empties the old logs when rvm starts.
+ *
+ * With lazy_recovery set, rvm_map neither truncates the log nor
+ * overlays it. It protects the segment and returns at once, while a
+ * thread gathers the segment's pending records from its log. The
+ * first access to each page waits for that, if need be, and applies
+ * the page's records. Pair it with mmap_segments so mapping does not
+ * read the segment either. As with page_tracking, system calls fail
+ * with EFAULT on pages not yet touched. rvm_snapshot, and
+ * rvm_begin_trans under page_tracking, recover the whole segment
+ * first.
+ *
+ * With trace_events > 0, rvm keeps that many of its most recent events
+ * in a ring: transactions, log writes and syncs, group commit batches,
+ * truncations and maps, each with its start time and duration. Adding
+ * an event takes a clock read and an atomic add, and never blocks.
+ * rvm_stats is kept either way. See rvm_read_trace.
+ */
+rvm_t rvm_init_opts(const char *directory, const rvm_options_t *opts);
+
+/*
+ * Reports how long the most recent log truncation or recovery spent
+ * in each phase.
+ */
+void rvm_replay_times(rvm_t rvm, rvm_replay_times_t *times);
+
+/*
+ * Reports how many bytes commits declared, how many of them actually
+ * changed and were logged, and what the log received for them.
+ */
+void rvm_redo_stats(rvm_t rvm, rvm_redo_stats_t *stats);
+
+/*
+ * Reports counters kept since rvm_init: transactions, declared and
+ * logged bytes, syncs, truncation, and the time spent in commits, log
+ * I/O, truncation and mapping. The counters are read one at a time,
+ * so they need not agree exactly while transactions are running.
+ */
+void rvm_stats(rvm_t rvm, rvm_stats_t *stats);
+
+/*
+ * Copies up to max of the most recent trace events into events, oldest
+ * first, and returns how many. Returns 0 unless trace_events was set.
+ * Events still being written are left out.
+ */
+size_t rvm_read_trace(rvm_t rvm, rvm_trace_event_t *events, size_t max);
+
+/*
+ * Prints the events rvm_read_trace would return to out, one per line,
+ * for instance when a commit took far longer than usual.
+ */
+void rvm_dump_trace(rvm_t rvm, FILE *out);
+
+/*
+ * Waits until every commit staged for group commit or buffered by
+ * RVM_DURABLE_NONE is in the log.
+ */
+void rvm_flush(rvm_t rvm);
+
 /*
  * Maps a segment from disk into memory. If the segment does not
  * already exist, then create it and give it size size_to_create. If
@@ -70,15 +416,33 @@ rvm_t rvm_init(const char *directory);
  * it until it is long enough. It is an error to try to map the same
  * segment twice.
  *
- * This procedure automatically truncates the log to ensure that the mapped data is current.
+ * This procedure automatically truncates the log to ensure that the
+ * mapped data is current, unless background truncation is enabled.
 */
-void *rvm_map(rvm_t rvm, const char *segname, int size_to_create);
+void *rvm_map(rvm_t rvm, const char *segname, size_t size_to_create);
 
 /*
  * Unmaps a segment from memory.
  */
 void rvm_unmap(rvm_t rvm, void *segbase);
 
+/*
+ * Returns a read-only view of the segment mapped at segbase as of the
+ * last commit, which later commits do not change. A transaction may be
+ * running on the segment meanwhile; its changes so far are left out.
+ * Unchanged pages are shared with the segment copy-on-write, so the
+ * snapshot costs memory only for pages written after it was taken.
+ * Segments mapped with mmap_segments are copied whole instead. The
+ * snapshot stays valid, even past unmapping the segment, until it is
+ * released. Returns (void *) -1 on error.
+ */
+const void *rvm_snapshot(rvm_t rvm, void *segbase);
+
+/*
+ * Releases a snapshot taken with rvm_snapshot.
+ */
+void rvm_snapshot_release(rvm_t rvm, const void *snapbase);
+
 /*
  *  Destroys a segment completely, erasing its backing store. This
  *  function should not be called on a segment that is currently
@@ -92,6 +456,10 @@ void rvm_destroy(rvm_t rvm, const char *segname);
  * modified by a transaction, then the call should will and return
  * (trans_t) -1. Note that trant_t needs to be able to be typecasted
  * to an integer type.
+ *
+ * Several threads may run transactions on one rvm at once, as long as
+ * each transaction is used by one thread at a time. Commits of
+ * transactions on disjoint segments write the log in parallel.
  */
 trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void **segbases);
 
@@ -101,9 +469,19 @@ trans_t rvm_begin_trans(rvm_t rvm, int numsegs, void **segbases);
  * segments specified in the call to rvm_begin_trans. Your library
  * needs to en* sure that the old memory has been saved, in case an
  * abort is executed. It is legal call rvm_about_to_modify multiple
- * times on the same memory area.
+ * times on the same memory area. segbase may also point inside the
+ * segment, in which case offset is relative to that pointer.
  */
-void rvm_about_to_modify(trans_t tid, void *segbase, int offset, int size);
+void rvm_about_to_modify(trans_t tid, void *segbase, size_t offset, size_t size);
+
+/*
+ * Declares n ranges of the segment at once, as if by calling
+ * rvm_about_to_modify for each, with offsets relative to segbase.
+ * The segment is looked up once and the ranges are sorted and merged
+ * before their undo data is captured. If any range lies outside the
+ * segment, none is declared.
+ */
+void rvm_about_to_modify_v(trans_t tid, void *segbase, const range_t *ranges, int n);
 
 /*
  * Commits all changes that have been made within the specified
@@ -111,6 +489,12 @@ void rvm_about_to_modify(trans_t tid, void *segbase, int offset, int size);
  * have been saved to disk so that, even if the program crashes, the
  * changes will be seen by the program when it restarts.
  *
+ * If there is no memory to encode or stage its redo records, or they
+ * could not be written to the log, the transaction is aborted
+ * instead: its changes are undone and it counts as an abort in
+ * rvm_stats. With group_commit_async, a batch that fails to be
+ * written after its commits have returned is only reported.
+ *
  * You will want to use fcntl or some such method. Consult the man
  * pages.
  */
@@ -122,9 +506,32 @@ void rvm_commit_trans(trans_t tid);
  */
 void rvm_abort_trans(trans_t tid);
 
+/*
+ * Sets a savepoint in the transaction. Savepoints nest: each one
+ * marks how far the undo records of every segment reach, and later
+ * ones lie inside it.
+ */
+savepoint_t rvm_savepoint(trans_t tid);
+
+/*
+ * Undoes the changes made since sp was set, newest first, and leaves
+ * the rest of the transaction as it was. Savepoints set after sp are
+ * dropped; sp itself stays and can be rolled back to again.
+ */
+void rvm_rollback_to(trans_t tid, savepoint_t sp);
+
 /*
  *  Plays through any committed or aborted items in the log file(s) and shrink the log file(s) as much as * possible.
  */
 void rvm_truncate_log(rvm_t rvm);
 
+/*
+ * Rewrites the part of the log not yet truncated so that it holds
+ * only the newest committed value of each byte, merging records that
+ * touch. Worth calling when the same data is committed over and over
+ * faster than it is truncated. Commits may run concurrently; they are
+ * held off only while the tail written meanwhile is copied over.
+ */
+void rvm_compact_log(rvm_t rvm);
+
 #endif
@@ -0,0 +1,76 @@
+#include "rvm_fault.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct fault_handler_t{
+  rvm_fault_fn fn;
+  void *arg;
+} fault_handler_t;
+
+static fault_handler_t handlers[RVM_FAULT_MAX];
+static volatile int nhandlers = 0;
+static struct sigaction prev_action;
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fault_dispatch(int sig, siginfo_t *info, void *ctx){
+  int i, n;
+
+  n = nhandlers;
+  for (i = 0; i < n; i++) {
+    if (handlers[i].fn(handlers[i].arg, info->si_addr))
+      return;
+  }
+
+  /* Not ours: hand it on, or fault again with the default action */
+  if (prev_action.sa_flags & SA_SIGINFO) {
+    prev_action.sa_sigaction(sig, info, ctx);
+  } else if (prev_action.sa_handler != SIG_DFL && prev_action.sa_handler != SIG_IGN) {
+    prev_action.sa_handler(sig);
+  } else {
+    signal(sig, SIG_DFL);
+  }
+}
+
+int rvm_fault_register(rvm_fault_fn fn, void *arg){
+  struct sigaction sa;
+  int ret = 0;
+
+  pthread_mutex_lock(&register_lock);
+
+  if (nhandlers == RVM_FAULT_MAX) {
+    ret = -1;
+  } else {
+    if (nhandlers == 0) {
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_sigaction = fault_dispatch;
+      sa.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      if (sigaction(SIGSEGV, &sa, &prev_action) != 0)
+        ret = -1;
+    }
+
+    if (ret == 0) {
+      handlers[nhandlers].fn = fn;
+      handlers[nhandlers].arg = arg;
+      /* The entry has to be complete before a fault can see it */
+      __sync_synchronize();
+      nhandlers++;
+    }
+  }
+
+  pthread_mutex_unlock(&register_lock);
+
+  return ret;
+}
+
+size_t rvm_fault_pagesize(void){
+  static size_t pagesize = 0;
+
+  if (pagesize == 0)
+    pagesize = (size_t) sysconf(_SC_PAGESIZE);
+
+  return pagesize;
+}
@@ -0,0 +1,33 @@
+/*
+ * Process-wide SIGSEGV dispatch for rvm's page protection tricks.
+ *
+ * Handlers are tried in registration order with the faulting address.
+ * One that recognises the address fixes up the page (typically with
+ * mprotect) and returns non-zero, and the faulting instruction is
+ * restarted. Faults nobody claims go to whatever handler was installed
+ * before, or kill the process as usual.
+ *
+ * Handlers run in signal context on the faulting thread. They must
+ * not take locks the interrupted code may hold.
+ */
+
+#ifndef RVM_FAULT_H
+#define RVM_FAULT_H
+
+#include <stddef.h>
+
+/* Most handlers that may be registered at once */
+#define RVM_FAULT_MAX (32)
+
+typedef int (*rvm_fault_fn)(void *arg, void *addr);
+
+/*
+ * Adds a handler, installing the SIGSEGV handler on first use.
+ * Returns 0 on success, -1 if the table is full or sigaction failed.
+ */
+int rvm_fault_register(rvm_fault_fn fn, void *arg);
+
+/* Size of a page, the unit of protection */
+size_t rvm_fault_pagesize(void);
+
+#endif
@@ -0,0 +1,504 @@
+#include "rvm_log.h"
+#include "rvm_lz.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY (0x82f63b78u)
+
+static uint32_t crc32c_table[256];
+static int crc32c_hw = 0;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void){
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+    crc32c_table[i] = c;
+  }
+
+#if defined(__x86_64__)
+  crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#if defined(__x86_64__)
+/* Eight bytes per crc32 instruction, with single bytes at either end */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len){
+  uint64_t c = crc, v;
+
+  while (len > 0 && ((uintptr_t) p & 7) != 0) {
+    c = _mm_crc32_u8((uint32_t) c, *p++);
+    len--;
+  }
+  while (len >= 8) {
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0)
+    c = _mm_crc32_u8((uint32_t) c, *p++);
+
+  return (uint32_t) c;
+}
+#endif
+
+uint32_t rvm_crc32c(uint32_t crc, const void *buf, size_t len){
+  const unsigned char *p = (const unsigned char *) buf;
+
+  pthread_once(&crc32c_once, crc32c_init);
+
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (crc32c_hw)
+    return ~crc32c_sse42(crc, p, len);
+#endif
+  while (len--)
+    crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+static uint32_t rec_checksum(rvm_rec_hdr_t *rh, const char *name, const void *data){
+  uint32_t saved, crc;
+
+  saved = rh->checksum;
+  rh->checksum = 0;
+  crc = rvm_crc32c(0, rh, sizeof(*rh));
+  crc = rvm_crc32c(crc, name, rh->namelen);
+  crc = rvm_crc32c(crc, data, (size_t) rh->length);
+  rh->checksum = saved;
+
+  return crc;
+}
+
+/* Checksum of a begin marker, which covers only the marker itself */
+static uint32_t marker_checksum(rvm_rec_hdr_t *rh){
+  uint32_t saved, crc;
+
+  saved = rh->checksum;
+  rh->checksum = 0;
+  crc = rvm_crc32c(0, rh, sizeof(*rh));
+  rh->checksum = saved;
+
+  return crc;
+}
+
+int rvm_log_write_header(int fd){
+  rvm_log_hdr_t lh;
+
+  memset(&lh, 0, sizeof(lh));
+  lh.magic = RVM_LOG_MAGIC;
+  lh.version = RVM_LOG_VERSION;
+  lh.hdrsize = sizeof(lh);
+
+  return pwrite(fd, &lh, sizeof(lh), 0) == sizeof(lh) ? 0 : -1;
+}
+
+size_t rvm_log_record_size(const char *segname, uint64_t length){
+  return sizeof(rvm_rec_hdr_t) + strlen(segname) + (size_t) length;
+}
+
+size_t rvm_log_encode_header(char *dst, const char *segname,
+                             uint64_t offset, uint64_t length){
+  rvm_rec_hdr_t rh;
+  size_t namelen;
+
+  namelen = strlen(segname);
+  if (namelen == 0 || namelen > RVM_LOG_NAME_MAX)
+    return 0;
+
+  /* The frame's commit marker covers the record */
+  memset(&rh, 0, sizeof(rh));
+  rh.magic = RVM_REC_MAGIC;
+  rh.namelen = (uint16_t) namelen;
+  rh.offset = offset;
+  rh.length = length;
+
+  memcpy(dst, &rh, sizeof(rh));
+  memcpy(dst + sizeof(rh), segname, namelen);
+
+  return sizeof(rh) + namelen;
+}
+
+size_t rvm_log_encode_record(char *dst, const char *segname,
+                             uint64_t offset, const void *data, uint64_t length){
+  size_t n;
+
+  if ((n = rvm_log_encode_header(dst, segname, offset, length)) == 0)
+    return 0;
+  memcpy(dst + n, data, (size_t) length);
+
+  return n + (size_t) length;
+}
+
+size_t rvm_log_encode_compressed(char *dst, const char *segname,
+                                 uint64_t offset, const void *data, uint64_t length){
+  rvm_rec_hdr_t rh;
+  size_t n, z;
+
+  if ((n = rvm_log_encode_header(dst, segname, offset, length)) == 0)
+    return 0;
+
+  /* Anything that does not save at least the length prefix stays as it is */
+  z = 0;
+  if (length > sizeof(uint64_t))
+    z = rvm_lz_compress(data, (size_t) length, dst + n + sizeof(uint64_t),
+                        (size_t) length - sizeof(uint64_t) - 1);
+  if (z == 0) {
+    memcpy(dst + n, data, (size_t) length);
+    return n + (size_t) length;
+  }
+
+  memcpy(dst + n, &length, sizeof(uint64_t));
+  memcpy(&rh, dst, sizeof(rh));
+  rh.flags = RVM_REC_LZ;
+  rh.length = sizeof(uint64_t) + z;
+  memcpy(dst, &rh, sizeof(rh));
+
+  return n + sizeof(uint64_t) + z;
+}
+
+size_t rvm_log_encode_xshard(char *dst, uint64_t xid, uint64_t shards){
+  rvm_rec_hdr_t rh;
+
+  memset(&rh, 0, sizeof(rh));
+  rh.magic = RVM_REC_MAGIC;
+  rh.flags = RVM_REC_XSHARD;
+  rh.offset = xid;
+  rh.length = sizeof(shards);
+
+  memcpy(dst, &rh, sizeof(rh));
+  memcpy(dst + sizeof(rh), &shards, sizeof(shards));
+
+  return RVM_LOG_XSHARD_SIZE;
+}
+
+size_t rvm_log_seal_frame(char *frame, size_t payload){
+  rvm_rec_hdr_t begin, commit;
+
+  memset(&begin, 0, sizeof(begin));
+  begin.magic = RVM_REC_MAGIC;
+  begin.flags = RVM_REC_BEGIN;
+  begin.length = payload;
+  begin.checksum = marker_checksum(&begin);
+
+  memset(&commit, 0, sizeof(commit));
+  commit.magic = RVM_REC_MAGIC;
+  commit.flags = RVM_REC_COMMIT;
+  commit.length = payload;
+  commit.checksum = rvm_crc32c(0, frame + sizeof(begin), payload);
+
+  memcpy(frame, &begin, sizeof(begin));
+  memcpy(frame + sizeof(begin) + payload, &commit, sizeof(commit));
+
+  return sizeof(begin) + payload + sizeof(commit);
+}
+
+/*
+ * Checks that the records of a frame whose markers matched all parse,
+ * so that none is applied unless every one can be. Returns the number
+ * of records, not counting a leading cross-shard record, or -1.
+ */
+static long frame_check(const char *p, uint64_t payload){
+  rvm_rec_hdr_t rh;
+  uint64_t pos = 0;
+  long n = 0;
+
+  memcpy(&rh, p, sizeof(rh));
+  if (payload >= RVM_LOG_XSHARD_SIZE && rh.magic == RVM_REC_MAGIC && rh.flags == RVM_REC_XSHARD) {
+    if (rh.namelen != 0 || rh.length != sizeof(uint64_t))
+      return -1;
+    pos = RVM_LOG_XSHARD_SIZE;
+  }
+
+  while (pos < payload) {
+    if (payload - pos < sizeof(rh))
+      return -1;
+    memcpy(&rh, p + pos, sizeof(rh));
+    if (rh.magic != RVM_REC_MAGIC || (rh.flags != 0 && rh.flags != RVM_REC_LZ) ||
+        rh.namelen == 0 || rh.namelen > RVM_LOG_NAME_MAX ||
+        payload - pos - sizeof(rh) < rh.namelen ||
+        rh.length > payload - pos - sizeof(rh) - rh.namelen ||
+        (rh.flags == RVM_REC_LZ && rh.length < sizeof(uint64_t)))
+      return -1;
+    pos += sizeof(rh) + rh.namelen + rh.length;
+    n++;
+  }
+
+  return n;
+}
+
+/*
+ * Decompresses every compressed record of a checked frame, one after
+ * the other into *zbuf, which grows to fit. Done before any record of
+ * the frame is applied, so a frame that does not decompress is treated
+ * as corrupt like any other. Returns 0, or -1.
+ */
+static int frame_inflate(const char *p, uint64_t payload, char **zbuf, size_t *zcap){
+  rvm_rec_hdr_t rh;
+  uint64_t pos, raw, total = 0;
+  const char *data;
+  char *nbuf;
+
+  for (pos = 0; pos < payload; pos += sizeof(rh) + rh.namelen + rh.length) {
+    memcpy(&rh, p + pos, sizeof(rh));
+    if (rh.flags != RVM_REC_LZ)
+      continue;
+    memcpy(&raw, p + pos + sizeof(rh) + rh.namelen, sizeof(raw));
+    if (raw > SIZE_MAX - total)
+      return -1;
+    total += raw;
+  }
+
+  if (total > *zcap) {
+    if ((nbuf = realloc(*zbuf, (size_t) total)) == NULL)
+      return -1;
+    *zbuf = nbuf;
+    *zcap = (size_t) total;
+  }
+
+  total = 0;
+  for (pos = 0; pos < payload; pos += sizeof(rh) + rh.namelen + rh.length) {
+    memcpy(&rh, p + pos, sizeof(rh));
+    if (rh.flags != RVM_REC_LZ)
+      continue;
+    data = p + pos + sizeof(rh) + rh.namelen;
+    memcpy(&raw, data, sizeof(raw));
+    if (rvm_lz_decompress(data + sizeof(raw), (size_t) rh.length - sizeof(raw),
+                          *zbuf + total, (size_t) raw) != 0)
+      return -1;
+    total += raw;
+  }
+
+  return 0;
+}
+
+/*
+ * Moves the unconsumed bytes [*pos, *len) to the front of buf and
+ * reads from fd until the buffer is full or the file ends. Returns the
+ * number of unconsumed bytes now available.
+ */
+static size_t log_fill(int fd, char *buf, size_t cap, size_t *pos, size_t *len){
+  ssize_t n;
+
+  if (*pos > 0) {
+    memmove(buf, buf + *pos, *len - *pos);
+    *len -= *pos;
+    *pos = 0;
+  }
+
+  while (*len < cap) {
+    n = read(fd, buf + *len, cap - *len);
+    if (n <= 0)
+      break;
+    *len += (size_t) n;
+  }
+
+  return *len;
+}
+
+uint64_t rvm_log_first_record(void){
+  return sizeof(rvm_log_hdr_t);
+}
+
+long rvm_log_replay(const char *path, uint64_t start, uint64_t limit, uint64_t *end,
+                    rvm_log_apply_fn fn, void *arg, rvm_log_frame_fn frame, void *farg){
+  int fd;
+  char *buf, *nbuf, *name, *data, *p, *zbuf = NULL;
+  char segname[RVM_LOG_NAME_MAX + 1];
+  size_t cap, len, pos, total, zcap = 0, zpos;
+  uint64_t consumed, filesize, fpos, length, shards;
+  rvm_log_hdr_t lh;
+  rvm_rec_hdr_t rh, ch;
+  struct stat st;
+  long count = 0, n;
+  int stopped = 0;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* A fresh log has no header yet */
+  filesize = (uint64_t) st.st_size;
+  if (end != NULL)
+    *end = start;
+  if (filesize == 0) {
+    close(fd);
+    return 0;
+  }
+  if (limit == 0 || limit > filesize)
+    limit = filesize;
+
+  cap = RVM_LOG_CHUNK;
+  if ((buf = malloc(cap)) == NULL) {
+    close(fd);
+    return -1;
+  }
+  len = pos = 0;
+
+  if (pread(fd, &lh, sizeof(lh), 0) != sizeof(lh)) {
+    printf("Redo log %s has a truncated header\n", path);
+    fflush(stdout);
+    free(buf);
+    close(fd);
+    return -1;
+  }
+
+  if (lh.magic != RVM_LOG_MAGIC || lh.version < 1 || lh.version > RVM_LOG_VERSION ||
+      lh.hdrsize < sizeof(lh)) {
+    printf("Redo log %s has an unknown format, not replaying it\n", path);
+    fflush(stdout);
+    free(buf);
+    close(fd);
+    return -1;
+  }
+
+  /* Start at the first record, or where the caller left off */
+  consumed = lh.hdrsize;
+  if (start > consumed)
+    consumed = start;
+  if (lseek(fd, (off_t) consumed, SEEK_SET) < 0) {
+    free(buf);
+    close(fd);
+    return -1;
+  }
+
+  while (consumed < limit && !stopped) {
+    /* Make sure the whole record header is buffered */
+    if (len - pos < sizeof(rh) && log_fill(fd, buf, cap, &pos, &len) < sizeof(rh))
+      break;
+
+    memcpy(&rh, buf + pos, sizeof(rh));
+    if (rh.magic != RVM_REC_MAGIC)
+      break;
+
+    if (rh.flags == RVM_REC_BEGIN) {
+      /* A frame: both markers and everything between them */
+      if (rh.namelen != 0 || marker_checksum(&rh) != rh.checksum ||
+          rh.length > filesize - consumed ||
+          filesize - consumed - rh.length < 2 * sizeof(rh))
+        break;
+    } else if (rh.flags == 0 && lh.version == 1) {
+      /* A bare record, as version 1 wrote them; it must fit in the file */
+      if (rh.namelen == 0 || rh.namelen > RVM_LOG_NAME_MAX ||
+          filesize - consumed < sizeof(rh) + rh.namelen ||
+          rh.length > filesize - consumed - sizeof(rh) - rh.namelen)
+        break;
+    } else {
+      break;
+    }
+
+    if (rh.flags == RVM_REC_BEGIN)
+      total = 2 * sizeof(rh) + (size_t) rh.length;
+    else
+      total = sizeof(rh) + rh.namelen + (size_t) rh.length;
+
+    /* Records larger than a chunk get a buffer of their own size */
+    if (total > cap) {
+      if ((nbuf = realloc(buf, total)) == NULL)
+        break;
+      buf = nbuf;
+      cap = total;
+    }
+
+    if (len - pos < total && log_fill(fd, buf, cap, &pos, &len) < total)
+      break;
+
+    if (rh.flags == 0) {
+      name = buf + pos + sizeof(rh);
+      data = name + rh.namelen;
+      if (rec_checksum(&rh, name, data) != rh.checksum)
+        break;
+
+      memcpy(segname, name, rh.namelen);
+      segname[rh.namelen] = '\0';
+
+      pos += total;
+      consumed += total;
+      count++;
+
+      if (fn != NULL && fn(arg, segname, rh.offset, data, rh.length) != 0)
+        stopped = 1;
+      continue;
+    }
+
+    /* A frame is only applied once its commit marker vouches for all of it */
+    p = buf + pos + sizeof(rh);
+    memcpy(&ch, p + rh.length, sizeof(ch));
+    if (ch.magic != RVM_REC_MAGIC || ch.flags != RVM_REC_COMMIT || ch.length != rh.length ||
+        rvm_crc32c(0, p, (size_t) rh.length) != ch.checksum ||
+        (n = frame_check(p, rh.length)) < 0 ||
+        frame_inflate(p, rh.length, &zbuf, &zcap) != 0)
+      break;
+
+    pos += total;
+    consumed += total;
+
+    /* A part of a cross-shard commit may have to be passed over */
+    fpos = 0;
+    memcpy(&ch, p, sizeof(ch));
+    if (ch.flags == RVM_REC_XSHARD) {
+      memcpy(&shards, p + sizeof(ch), sizeof(shards));
+      if (frame != NULL && frame(farg, ch.offset, shards) != 0)
+        continue;
+      fpos = RVM_LOG_XSHARD_SIZE;
+    }
+    count += n;
+    if (fn == NULL)
+      continue;
+
+    /* A stop request takes effect at the end of the frame */
+    zpos = 0;
+    for (; fpos < rh.length; fpos += sizeof(ch) + ch.namelen + ch.length) {
+      memcpy(&ch, p + fpos, sizeof(ch));
+      name = p + fpos + sizeof(ch);
+      memcpy(segname, name, ch.namelen);
+      segname[ch.namelen] = '\0';
+
+      data = name + ch.namelen;
+      length = ch.length;
+      if (ch.flags == RVM_REC_LZ) {
+        memcpy(&length, data, sizeof(length));
+        data = zbuf + zpos;
+        zpos += (size_t) length;
+      }
+
+      if (fn(arg, segname, ch.offset, data, length) != 0)
+        stopped = 1;
+    }
+  }
+
+  if (end != NULL)
+    *end = consumed;
+
+  if (!stopped && consumed < limit) {
+    printf("Stopped replaying %s at a torn or corrupt record (byte %llu of %llu)\n",
+           path, (unsigned long long) consumed, (unsigned long long) filesize);
+    fflush(stdout);
+  }
+
+  free(buf);
+  free(zbuf);
+  close(fd);
+
+  return count;
+}
@@ -0,0 +1,159 @@
+/*
+ * On-disk format of the rvm redo log.
+ *
+ * The log starts with a fixed file header followed by a sequence of
+ * length-prefixed binary records. Each record is a rvm_rec_hdr_t, the
+ * segment name (namelen bytes, not NUL terminated) and then length
+ * bytes of post-image data to be written at offset in the segment.
+ * All fields are stored in host byte order.
+ *
+ * Since version 2 the records of each commit are framed: a begin
+ * marker giving the length of the records, the records themselves,
+ * and a commit marker carrying the CRC32C of all of them. A commit is
+ * replayed whole or not at all. Version 1 logs hold bare records,
+ * each with a CRC32C of its own; replay still accepts them there.
+ *
+ * Since version 3 a framed record may be compressed with rvm_lz. Its
+ * data is then the uncompressed length as a uint64_t followed by the
+ * compressed bytes, and length counts both.
+ *
+ * Also since version 3, a commit spread over several logs leaves one
+ * frame in each. Each such frame starts with a cross-shard record with
+ * no name: offset is the commit's id, and its data is a uint64_t mask
+ * of the logs holding a frame of the commit.
+ */
+
+#ifndef RVM_LOG_H
+#define RVM_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define RVM_LOG_MAGIC    (0x474c5652u)  /* "RVLG" */
+#define RVM_LOG_VERSION  (3)
+#define RVM_REC_MAGIC    (0x43455252u)  /* "RREC" */
+
+/* rvm_rec_hdr_t flags */
+#define RVM_REC_BEGIN    (0x1)  /* Begin marker: length is the size of the framed records */
+#define RVM_REC_COMMIT   (0x2)  /* Commit marker: checksum covers the framed records */
+#define RVM_REC_LZ       (0x4)  /* Framed record whose data is compressed */
+#define RVM_REC_XSHARD   (0x8)  /* First record of a frame that is part of a cross-shard commit */
+
+/* Size of the chunks the replay engine reads the log in */
+#define RVM_LOG_CHUNK    (1 << 20)
+
+/* Longest segment name a record may carry */
+#define RVM_LOG_NAME_MAX (255)
+
+typedef struct rvm_log_hdr_t{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdrsize;   /*sizeof(rvm_log_hdr_t), lets later versions extend it*/
+} rvm_log_hdr_t;
+
+typedef struct rvm_rec_hdr_t{
+  uint32_t magic;
+  uint16_t namelen;   /*Length of the segment name following the header*/
+  uint16_t flags;
+  uint64_t offset;    /*Offset of the update within the segment*/
+  uint64_t length;    /*Number of data bytes following the name*/
+  uint32_t checksum;  /*CRC32C of the header (with checksum zeroed), name and data; see above for markers*/
+  uint32_t reserved;
+} rvm_rec_hdr_t;
+
+/*
+ * Called by rvm_log_replay once per valid record, in log order. The
+ * segment name is NUL terminated. Return non-zero to stop the replay.
+ */
+typedef int (*rvm_log_apply_fn)(void *arg, const char *segname,
+                                uint64_t offset, const void *data, uint64_t length);
+
+/*
+ * Called by rvm_log_replay before the records of a frame that is part
+ * of a cross-shard commit. Return non-zero to skip the frame's records.
+ */
+typedef int (*rvm_log_frame_fn)(void *arg, uint64_t xid, uint64_t shards);
+
+/* Bytes the begin and commit markers add to a frame */
+#define RVM_LOG_FRAME_OVERHEAD (2 * sizeof(rvm_rec_hdr_t))
+
+/* Bytes of a cross-shard record */
+#define RVM_LOG_XSHARD_SIZE (sizeof(rvm_rec_hdr_t) + sizeof(uint64_t))
+
+/*
+ * Extends crc (0 to start) with the CRC32C of buf. Uses the SSE4.2
+ * crc32 instruction when the CPU has it.
+ */
+uint32_t rvm_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* Writes the file header at the start of fd, which should be empty */
+int rvm_log_write_header(int fd);
+
+/* Number of bytes a record for length bytes of segname occupies */
+size_t rvm_log_record_size(const char *segname, uint64_t length);
+
+/*
+ * Encodes a single update record into dst, which must have room for
+ * rvm_log_record_size bytes. Returns the number of bytes written, or
+ * 0 if the segment name is too long. The record is only valid once
+ * sealed into a frame.
+ */
+size_t rvm_log_encode_record(char *dst, const char *segname,
+                             uint64_t offset, const void *data, uint64_t length);
+
+/*
+ * Like rvm_log_encode_record, but compresses the data if that makes
+ * the record smaller. dst still needs room for the uncompressed
+ * record. Returns the number of bytes written, or 0 on failure.
+ */
+size_t rvm_log_encode_compressed(char *dst, const char *segname,
+                                 uint64_t offset, const void *data, uint64_t length);
+
+/*
+ * Encodes just the header and name of a record for length bytes at
+ * offset, for callers that gather the data from several places. The
+ * data must follow directly. Returns the number of bytes written, or
+ * 0 if the segment name is too long.
+ */
+size_t rvm_log_encode_header(char *dst, const char *segname,
+                             uint64_t offset, uint64_t length);
+
+/*
+ * Encodes the cross-shard record that has to open each frame of
+ * commit xid, whose frames go to the logs in the shards mask. Returns
+ * RVM_LOG_XSHARD_SIZE.
+ */
+size_t rvm_log_encode_xshard(char *dst, uint64_t xid, uint64_t shards);
+
+/*
+ * Seals the records of one commit into a frame. frame has room for
+ * the begin marker, then holds payload bytes of encoded records, then
+ * has room for the commit marker. Fills in both markers and returns
+ * the size of the whole frame.
+ */
+size_t rvm_log_seal_frame(char *frame, size_t payload);
+
+/*
+ * Streams through the log at path, calling fn for every record. The
+ * log is read in RVM_LOG_CHUNK sized pieces; replay stops cleanly at
+ * the first torn or corrupt frame, so no part of it is applied. If fn
+ * asks to stop, it still sees the rest of the current frame. With fn
+ * NULL the records are only checked and counted, which is enough to
+ * find where the valid part of a log ends.
+ *
+ * Replay starts at byte start (0 means the first record) and does not
+ * start any record at or beyond limit (0 means the end of the file).
+ * If end is not NULL it receives the offset just past the last frame
+ * consumed, which is where a later replay should pick up. frame, if
+ * not NULL, is called with farg to decide whether the frames of
+ * cross-shard commits are applied. Returns the number of records
+ * applied, or -1 if the log could not be read or has an unknown
+ * format.
+ */
+long rvm_log_replay(const char *path, uint64_t start, uint64_t limit, uint64_t *end,
+                    rvm_log_apply_fn fn, void *arg, rvm_log_frame_fn frame, void *farg);
+
+/* Offset of the first record in a log */
+uint64_t rvm_log_first_record(void);
+
+#endif
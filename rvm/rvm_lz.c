@@ -0,0 +1,165 @@
+#include "rvm_lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_HASH_BITS   (12)
+#define LZ_MIN_MATCH   (4)
+#define LZ_MAX_OFFSET  (65535)
+#define LZ_SKIP_SHIFT  (6)     /*After 2^LZ_SKIP_SHIFT misses in a row, probe every other byte, and so on*/
+
+static uint32_t lz_hash(const unsigned char *p){
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extra bytes of a length that did not fit its nibble */
+static unsigned char *lz_putlen(unsigned char *op, unsigned char *oend, size_t len){
+  for (; len >= 255; len -= 255) {
+    if (op == oend)
+      return NULL;
+    *op++ = 255;
+  }
+  if (op == oend)
+    return NULL;
+  *op++ = (unsigned char) len;
+
+  return op;
+}
+
+/*
+ * Writes one sequence: nlit literals from lit, then a match of mlen
+ * bytes offset back, unless mlen is 0 for the final sequence. Returns
+ * the new end of the output, or NULL if it ran out of room.
+ */
+static unsigned char *lz_sequence(unsigned char *op, unsigned char *oend, const unsigned char *lit,
+                                  size_t nlit, size_t mlen, size_t offset){
+  unsigned char *token;
+
+  if (op == oend)
+    return NULL;
+  token = op++;
+  *token = (unsigned char) ((nlit < 15 ? nlit : 15) << 4);
+  if (nlit >= 15 && (op = lz_putlen(op, oend, nlit - 15)) == NULL)
+    return NULL;
+
+  if ((size_t) (oend - op) < nlit)
+    return NULL;
+  memcpy(op, lit, nlit);
+  op += nlit;
+
+  if (mlen == 0)
+    return op;
+
+  if (oend - op < 2)
+    return NULL;
+  *op++ = (unsigned char) (offset & 0xff);
+  *op++ = (unsigned char) (offset >> 8);
+
+  mlen -= LZ_MIN_MATCH;
+  *token |= (unsigned char) (mlen < 15 ? mlen : 15);
+  if (mlen >= 15 && (op = lz_putlen(op, oend, mlen - 15)) == NULL)
+    return NULL;
+
+  return op;
+}
+
+size_t rvm_lz_compress(const void *src, size_t n, void *dst, size_t cap){
+  const unsigned char *in = (const unsigned char *) src;
+  unsigned char *op = (unsigned char *) dst, *oend = op + cap;
+  uint32_t table[1 << LZ_HASH_BITS];  /*Position + 1 of the last occurrence of each hash*/
+  size_t ip, anchor, ref, len;
+  uint32_t h;
+
+  memset(table, 0, sizeof(table));
+
+  ip = anchor = 0;
+  while (ip + LZ_MIN_MATCH <= n) {
+    h = lz_hash(in + ip);
+    ref = table[h];
+    table[h] = (uint32_t) (ip + 1);
+
+    if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || memcmp(in + ref - 1, in + ip, LZ_MIN_MATCH) != 0) {
+      ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+      continue;
+    }
+
+    ref--;
+    for (len = LZ_MIN_MATCH; ip + len < n && in[ref + len] == in[ip + len]; len++)
+      ;
+
+    if ((op = lz_sequence(op, oend, in + anchor, ip - anchor, len, ip - ref)) == NULL)
+      return 0;
+    ip += len;
+    anchor = ip;
+  }
+
+  if ((op = lz_sequence(op, oend, in + anchor, n - anchor, 0, 0)) == NULL)
+    return 0;
+
+  return (size_t) (op - (unsigned char *) dst);
+}
+
+/* Reads the extra bytes of a length whose nibble was 15 */
+static int lz_getlen(const unsigned char **ip, const unsigned char *iend, size_t *len){
+  unsigned char b;
+
+  do {
+    if (*ip == iend)
+      return -1;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+
+  return 0;
+}
+
+int rvm_lz_decompress(const void *src, size_t n, void *dst, size_t rawlen){
+  const unsigned char *ip = (const unsigned char *) src, *iend = ip + n;
+  unsigned char *out = (unsigned char *) dst, *op = out, *oend = out + rawlen;
+  size_t nlit, mlen, offset, i;
+  unsigned char token;
+
+  while (ip < iend) {
+    token = *ip++;
+
+    nlit = token >> 4;
+    if (nlit == 15 && lz_getlen(&ip, iend, &nlit) != 0)
+      return -1;
+    if (nlit > (size_t) (iend - ip) || nlit > (size_t) (oend - op))
+      return -1;
+    memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+
+    /* The final sequence is literals only */
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return -1;
+    offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+    ip += 2;
+
+    mlen = token & 15;
+    if (mlen == 15 && lz_getlen(&ip, iend, &mlen) != 0)
+      return -1;
+    mlen += LZ_MIN_MATCH;
+
+    if (offset == 0 || offset > (size_t) (op - out) || mlen > (size_t) (oend - op))
+      return -1;
+
+    /* Matches may overlap their own output, which repeats it */
+    if (offset >= mlen) {
+      memcpy(op, op - offset, mlen);
+    } else {
+      for (i = 0; i < mlen; i++)
+        op[i] = op[i - offset];
+    }
+    op += mlen;
+  }
+
+  return op == oend ? 0 : -1;
+}
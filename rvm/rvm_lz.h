@@ -0,0 +1,34 @@
+/*
+ * A small LZ77 codec for redo records.
+ *
+ * The format follows LZ4 blocks: each sequence is a token byte whose
+ * high nibble counts literals and whose low nibble is the match length
+ * less four, with 15 in either meaning more length bytes follow. Then
+ * come the literals, and unless the input ends there, a two byte
+ * little endian offset back into the output and the match length
+ * bytes. Matches reach back at most 64 KB.
+ *
+ * It favours speed over ratio: one hash probe per position, and
+ * incompressible stretches are skipped ever faster.
+ */
+
+#ifndef RVM_LZ_H
+#define RVM_LZ_H
+
+#include <stddef.h>
+
+/*
+ * Compresses the n bytes at src into dst, which has room for cap
+ * bytes. Returns the compressed size, or 0 if that would not fit in
+ * cap, so passing cap < n asks for real savings or nothing.
+ */
+size_t rvm_lz_compress(const void *src, size_t n, void *dst, size_t cap);
+
+/*
+ * Decompresses the n bytes at src into exactly rawlen bytes at dst.
+ * Returns 0 on success, -1 if the input is malformed or does not
+ * produce rawlen bytes.
+ */
+int rvm_lz_decompress(const void *src, size_t n, void *dst, size_t rawlen);
+
+#endif
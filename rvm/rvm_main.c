@@ -2,10 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include "rvm.h"
 
+/* Regions proc3 commits while the log is truncated under it */
+#define TRUNC_REGIONS     (200)
+#define TRUNC_REGION_SIZE (64 * 1024)
+
+static volatile int truncating;
+
+/* Log size the background truncator is set to keep below */
+#define TRUNC_THRESHOLD   (64 * 1024)
+
 /* proc1 writes some data, commits it, then exits */
 void proc1() 
 {
@@ -87,6 +97,204 @@ void proc2()
 }
 
 
+/* Fails the run unless seg holds want at offset */
+void expect(const char *seg, int offset, const char *want, const char *what)
+{
+  if(memcmp(seg + offset, want, strlen(want))) {
+    fprintf(stderr, "Savepoints%s: found \"%.*s\" at %d instead of \"%s\".\n",
+            what, (int) strlen(want), seg + offset, offset, want);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Writes str at offset, declared first unless page tracking is on to
+ * trap the write.
+ */
+void sp_write(trans_t trans, char *seg, int offset, const char *str, int tracking)
+{
+  if(!tracking)
+    rvm_about_to_modify(trans, seg, offset, strlen(str));
+  memcpy(seg + offset, str, strlen(str));
+}
+
+/* savepoints rolls back to savepoints, then commits or aborts what is left */
+void savepoints(int tracking)
+{
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  savepoint_t sp1, sp2;
+  char* seg;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.page_tracking = tracking;
+  rvm = rvm_init_opts("rvm_segments", &opts);
+  rvm_destroy(rvm, "spseg");
+  seg = (char *) rvm_map(rvm, "spseg", 3 * 4096);
+
+  /* Nested: rolling back to the inner savepoint keeps the outer's writes */
+  trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+  sp_write(trans, seg, 0, "aaaa", tracking);
+  sp1 = rvm_savepoint(trans);
+  sp_write(trans, seg, 0, "bbbbbbbb", tracking);
+  sp2 = rvm_savepoint(trans);
+  sp_write(trans, seg, 2, "cc", tracking);
+  sp_write(trans, seg, 4096, "cccc", tracking);
+  rvm_rollback_to(trans, sp2);
+  expect(seg, 0, "bbbbbbbb", " (inner rollback)");
+  expect(seg, 4096, "\0\0\0\0", " (inner rollback)");
+  rvm_rollback_to(trans, sp1);
+  expect(seg, 0, "aaaa\0\0\0\0", " (outer rollback)");
+
+  /* The same savepoint again, after new writes and with none */
+  sp_write(trans, seg, 2, "dddd", tracking);
+  sp_write(trans, seg, 8192, "dddd", tracking);
+  rvm_rollback_to(trans, sp1);
+  expect(seg, 0, "aaaa\0\0\0\0", " (second rollback)");
+  expect(seg, 8192, "\0\0\0\0", " (second rollback)");
+  rvm_rollback_to(trans, sp1);
+  expect(seg, 0, "aaaa\0\0\0\0", " (idle rollback)");
+
+  /* Writes after the last rollback stay */
+  sp_write(trans, seg, 8192, "eeee", tracking);
+  rvm_commit_trans(trans);
+
+  /* Aborting undoes writes on both sides of a savepoint */
+  trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+  sp_write(trans, seg, 0, "ffff", tracking);
+  sp1 = rvm_savepoint(trans);
+  sp_write(trans, seg, 4096, "ffff", tracking);
+  rvm_savepoint(trans);
+  sp_write(trans, seg, 2, "gg", tracking);
+  rvm_abort_trans(trans);
+  expect(seg, 0, "aaaa\0\0\0\0", " (abort)");
+  expect(seg, 4096, "\0\0\0\0", " (abort)");
+  expect(seg, 8192, "eeee", " (abort)");
+
+  /* Only what survived the rollbacks was committed */
+  rvm_unmap(rvm, seg);
+  rvm = rvm_init_opts("rvm_segments", &opts);
+  seg = (char *) rvm_map(rvm, "spseg", 3 * 4096);
+  expect(seg, 0, "aaaa\0\0\0\0", " (after remap)");
+  expect(seg, 4096, "\0\0\0\0", " (after remap)");
+  expect(seg, 8192, "eeee", " (after remap)");
+  rvm_unmap(rvm, seg);
+}
+
+
+/* Truncates the log over and over until truncating is cleared */
+void *truncate_loop(void *arg)
+{
+  while(truncating)
+    rvm_truncate_log((rvm_t) arg);
+
+  return NULL;
+}
+
+/*
+ * proc3 commits regions of a segment without durability while another
+ * thread keeps truncating the log, then flushes and exits
+ */
+void proc3()
+{
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  pthread_t thread;
+  char* seg;
+  int i;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.durability = RVM_DURABLE_NONE;
+  rvm = rvm_init_opts("rvm_segments", &opts);
+  rvm_destroy(rvm, "truncseg");
+  seg = (char *) rvm_map(rvm, "truncseg", TRUNC_REGIONS * TRUNC_REGION_SIZE);
+
+  truncating = 1;
+  pthread_create(&thread, NULL, truncate_loop, rvm);
+  for(i = 0; i < TRUNC_REGIONS; i++) {
+    trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+    rvm_about_to_modify(trans, seg, i * TRUNC_REGION_SIZE, TRUNC_REGION_SIZE);
+    memset(seg + i * TRUNC_REGION_SIZE, i + 1, TRUNC_REGION_SIZE);
+    rvm_commit_trans(trans);
+  }
+  truncating = 0;
+  pthread_join(thread, NULL);
+
+  rvm_flush(rvm);
+}
+
+/* proc4 checks that every region proc3 committed is there */
+void proc4()
+{
+  rvm_t rvm;
+  char* seg;
+  int i, j;
+
+  rvm = rvm_init("rvm_segments");
+  seg = (char *) rvm_map(rvm, "truncseg", TRUNC_REGIONS * TRUNC_REGION_SIZE);
+
+  for(i = 0; i < TRUNC_REGIONS; i++) {
+    for(j = 0; j < TRUNC_REGION_SIZE; j++) {
+      if(seg[i * TRUNC_REGION_SIZE + j] != (char) (i + 1)) {
+        fprintf(stderr, "Region %d, committed while the log was truncated, was lost.\n", i);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  rvm_unmap(rvm, seg);
+}
+
+
+/*
+ * background commits without durability until the log is several times
+ * the truncation threshold, and waits for the truncator to shrink it
+ */
+void background()
+{
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  rvm_stats_t stats;
+  char* seg;
+  int i, offset;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.durability = RVM_DURABLE_NONE;
+  opts.truncate_threshold = TRUNC_THRESHOLD;
+  rvm = rvm_init_opts("rvm_segments", &opts);
+  rvm_destroy(rvm, "bgseg");
+  seg = (char *) rvm_map(rvm, "bgseg", 1 << 20);
+
+  for(i = 0; i < 2000; i++) {
+    offset = (i * 128) % (1 << 20);
+    trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+    rvm_about_to_modify(trans, seg, offset, 128);
+    memset(seg + offset, i, 128);
+    rvm_commit_trans(trans);
+  }
+  rvm_flush(rvm);
+
+  /*
+   * What the last wake-up leaves is at most a threshold and a commit.
+   * The log file may keep its size, with the applied part punched out.
+   */
+  for(i = 0; i < 200; i++) {
+    rvm_stats(rvm, &stats);
+    if(stats.log_bytes <= 2 * TRUNC_THRESHOLD)
+      break;
+    usleep(10000);
+  }
+  if(i == 200) {
+    fprintf(stderr, "The background truncator left %llu bytes of log.\n",
+            (unsigned long long) stats.log_bytes);
+    exit(EXIT_FAILURE);
+  }
+  rvm_unmap(rvm, seg);
+}
+
+
 int main(int argc, char **argv)
 {
   int pid;
@@ -104,6 +312,25 @@ int main(int argc, char **argv)
 
   proc2();
 
+  savepoints(0);
+  savepoints(1);
+
+  pid = fork();
+  if(pid < 0) {
+    perror("fork");
+    exit(2);
+  }
+  if(pid == 0) {
+    proc3();
+    exit(EXIT_SUCCESS);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  proc4();
+
+  background();
+
   printf("Ok\n");
 
   return 0;
@@ -0,0 +1,1259 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "rvm.h"
+#include "rvm_log.h"
+
+#define PERFORM_DIR  "rvm_perform_segments"
+#define SEG_SIZE     (1 << 20)
+#define UPDATE_SIZE  (64)
+
+/* Most committer threads in the concurrency experiment */
+#define MAX_THREADS  (16)
+
+/* Segments the recovery experiment spreads its log over */
+#define RECOVERY_SEGS (32)
+
+/* Most segments and ranges per transaction in the sweep */
+#define SWEEP_MAX_SEGS   (16)
+#define SWEEP_MAX_RANGES (256)
+
+/* Every this many transactions of the sweep aborts instead of committing */
+#define SWEEP_ABORT_EVERY (10)
+
+/* Crash injection: slots every transaction sets to its sequence number */
+#define CRASH_SLOTS  (8)
+
+/* Segment sizes swept by the large segment experiment, in GB */
+#define LARGE_MIN_GB (8)
+#define LARGE_MAX_GB (32)
+
+/*
+ * Latency histogram in nanoseconds, HDR style: each power of two is
+ * split into HIST_SUB linear buckets, so a bucket is at most 1/HIST_SUB
+ * of its values wide. Values below HIST_SUB get a bucket each, those
+ * of 2^HIST_MAX_BITS and up share the last one.
+ */
+#define HIST_SUB_BITS (4)
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS (40)
+#define HIST_BUCKETS  ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct{
+  long counts[HIST_BUCKETS];
+  long n;
+  double max_ns;
+} histogram_t;
+
+static double now_sec(){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void hist_add(histogram_t *h, double ns){
+  unsigned long v = ns > 0 ? (unsigned long) ns : 0;
+  int b, e;
+
+  if (v < HIST_SUB) {
+    b = (int) v;
+  } else {
+    for (e = HIST_SUB_BITS; e < HIST_MAX_BITS - 1 && (v >> (e + 1)) != 0; e++);
+    if ((v >> (e + 1)) != 0)
+      b = HIST_BUCKETS - 1;
+    else
+      b = (e - HIST_SUB_BITS + 1) * HIST_SUB + (int) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+  }
+  h->counts[b]++;
+  h->n++;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+}
+
+/*
+ * Upper bound in microseconds of the bucket holding percentile p,
+ * within 1/HIST_SUB of the percentile itself, and never past the
+ * largest value seen.
+ */
+static double hist_percentile(histogram_t *h, double p){
+  long seen, target;
+  double upper;
+  int b, g;
+
+  target = (long) (p * h->n);
+  seen = 0;
+  for (b = 0; b < HIST_BUCKETS - 1; b++) {
+    seen += h->counts[b];
+    if (seen > target)
+      break;
+  }
+
+  g = b / HIST_SUB;
+  if (g == 0)
+    upper = b + 1;
+  else
+    upper = (double) ((unsigned long) (HIST_SUB + b % HIST_SUB + 1) << (g - 1));
+  if (upper > h->max_ns)
+    upper = h->max_ns;
+
+  return upper / 1e3;
+}
+
+/*
+ * Runs num_commits back-to-back small transactions, returns
+ * commits/sec. If hist is not NULL, every commit's latency is added.
+ */
+static double run_commits(rvm_options_t *opts, int num_commits, histogram_t *hist){
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  int i, offset;
+  double start, elapsed, t;
+
+  rvm = rvm_init_opts(PERFORM_DIR, opts);
+  rvm_destroy(rvm, "perfseg");
+  rvm_truncate_log(rvm);
+  seg = (char *) rvm_map(rvm, "perfseg", SEG_SIZE);
+
+  start = now_sec();
+  for (i = 0; i < num_commits; i++) {
+    offset = (i * UPDATE_SIZE) % (SEG_SIZE - UPDATE_SIZE);
+
+    trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+    rvm_about_to_modify(trans, seg, offset, UPDATE_SIZE);
+    memset(seg + offset, i & 0xff, UPDATE_SIZE);
+
+    t = now_sec();
+    rvm_commit_trans(trans);
+    if (hist != NULL)
+      hist_add(hist, (now_sec() - t) * 1e9);
+  }
+  rvm_flush(rvm);
+  elapsed = now_sec() - start;
+
+  rvm_unmap(rvm, seg);
+  rvm_truncate_log(rvm);
+
+  return num_commits / elapsed;
+}
+
+typedef struct{
+  rvm_t rvm;
+  char *seg;
+  int num_commits;
+} committer_t;
+
+static void *committer(void *arg){
+  committer_t *c = (committer_t *) arg;
+  trans_t trans;
+  int i, offset;
+
+  for (i = 0; i < c->num_commits; i++) {
+    offset = (i * UPDATE_SIZE) % (SEG_SIZE - UPDATE_SIZE);
+
+    trans = rvm_begin_trans(c->rvm, 1, (void **) &(c->seg));
+    rvm_about_to_modify(trans, c->seg, offset, UPDATE_SIZE);
+    memset(c->seg + offset, i & 0xff, UPDATE_SIZE);
+    rvm_commit_trans(trans);
+  }
+
+  return NULL;
+}
+
+/*
+ * Group commit: n threads commit num_commits transactions each to
+ * segments of their own, synced and waiting for their batch, with
+ * batch sizes from off (0) up to one commit per thread. Every batch
+ * is one append and one fdatasync, so the rate should grow with the
+ * batch until it outgrows the committers that can fill it.
+ */
+static void perform_group(int num_commits){
+  committer_t c[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  rvm_options_t opts;
+  rvm_t rvm;
+  char segname[32];
+  int n, batch, i;
+  double start, elapsed;
+
+  printf("threads,batch_size,commits,commits_per_sec\n");
+  for (n = 1; n <= MAX_THREADS; n *= 2) {
+    for (batch = 0; batch <= n; batch = batch ? batch * 2 : 1) {
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = RVM_DURABLE_FDATASYNC;
+      opts.group_commit_batch = batch;
+      opts.group_commit_delay_us = 1000;
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+      rvm_truncate_log(rvm);
+
+      for (i = 0; i < n; i++) {
+        sprintf(segname, "groupseg%d", i);
+        rvm_destroy(rvm, segname);
+        c[i].rvm = rvm;
+        c[i].seg = (char *) rvm_map(rvm, segname, SEG_SIZE);
+        c[i].num_commits = num_commits;
+      }
+
+      start = now_sec();
+      for (i = 0; i < n; i++)
+        pthread_create(&threads[i], NULL, committer, &c[i]);
+      for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+      elapsed = now_sec() - start;
+
+      printf("%d,%d,%d,%.0f\n", n, batch, n * num_commits, n * num_commits / elapsed);
+      fflush(stdout);
+
+      for (i = 0; i < n; i++) {
+        rvm_unmap(rvm, c[i].seg);
+        sprintf(segname, "groupseg%d", i);
+        rvm_destroy(rvm, segname);
+      }
+      rvm_truncate_log(rvm);
+    }
+  }
+}
+
+/* Commit latency histogram for each durability level */
+static void perform_durability(int num_commits){
+  static const char *names[] = {"default", "none", "flush", "fdatasync", "dsync"};
+  rvm_options_t opts;
+  histogram_t hist;
+  int level, b;
+  double rate;
+
+  printf("durability,bucket_le_us,commits\n");
+  for (level = RVM_DURABLE_NONE; level <= RVM_DURABLE_DSYNC; level++) {
+    memset(&opts, 0, sizeof(opts));
+    memset(&hist, 0, sizeof(hist));
+    opts.durability = (rvm_durability_t) level;
+
+    rate = run_commits(&opts, num_commits, &hist);
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+      if (hist.counts[b] > 0)
+        printf("%s,%.3f,%ld\n", names[level], (1L << (b + 1)) / 1e3, hist.counts[b]);
+    }
+    fprintf(stderr, "%s: %.0f commits/sec, p50 <= %.3f us, p99 <= %.3f us, max %.3f us\n",
+            names[level], rate, hist_percentile(&hist, 0.5),
+            hist_percentile(&hist, 0.99), hist.max_ns / 1e3);
+    fflush(stdout);
+  }
+}
+
+/*
+ * Large segments: maps segments of LARGE_MIN_GB and up with mmap and
+ * commits updates scattered over the whole of each, so most offsets
+ * are past what an int can hold. Checks the updates survive a remap.
+ */
+static void perform_large(int num_commits){
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  size_t size, offset;
+  int i, gb, bad;
+  double t, map_sec, commit_sec, truncate_sec;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.mmap_segments = 1;
+  opts.durability = RVM_DURABLE_FLUSH;
+
+  printf("segment_gb,commits,map_sec,commits_per_sec,truncate_sec,verified\n");
+  for (gb = LARGE_MIN_GB; gb <= LARGE_MAX_GB; gb *= 2) {
+    size = (size_t) gb << 30;
+
+    rvm = rvm_init_opts(PERFORM_DIR, &opts);
+    rvm_destroy(rvm, "largeseg");
+
+    t = now_sec();
+    seg = (char *) rvm_map(rvm, "largeseg", size);
+    map_sec = now_sec() - t;
+    if (seg == (char *) -1) {
+      fprintf(stderr, "Couldn't map a %d GB segment\n", gb);
+      return;
+    }
+
+    t = now_sec();
+    for (i = 0; i < num_commits; i++) {
+      offset = ((size_t) i * 2654435761u * UPDATE_SIZE) % (size - UPDATE_SIZE);
+
+      trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+      rvm_about_to_modify(trans, seg, offset, UPDATE_SIZE);
+      memset(seg + offset, (i & 0x7f) + 1, UPDATE_SIZE);
+      rvm_commit_trans(trans);
+    }
+    rvm_flush(rvm);
+    commit_sec = now_sec() - t;
+
+    t = now_sec();
+    rvm_truncate_log(rvm);
+    truncate_sec = now_sec() - t;
+
+    /* Read the updates back through a fresh mapping */
+    rvm_unmap(rvm, seg);
+    seg = (char *) rvm_map(rvm, "largeseg", size);
+    bad = 0;
+    for (i = 0; i < num_commits; i++) {
+      offset = ((size_t) i * 2654435761u * UPDATE_SIZE) % (size - UPDATE_SIZE);
+      if (seg[offset] == 0)
+        bad++;
+    }
+    rvm_unmap(rvm, seg);
+    rvm_destroy(rvm, "largeseg");
+
+    printf("%d,%d,%.3f,%.0f,%.3f,%s\n", gb, num_commits, map_sec,
+           num_commits / commit_sec, truncate_sec, bad == 0 ? "yes" : "no");
+    fflush(stdout);
+  }
+}
+
+/*
+ * Write-heavy transactions: many small writes to a few pages, each
+ * declared with rvm_about_to_modify, all declared with one call to
+ * rvm_about_to_modify_v, or trapped by page tracking with nothing
+ * declared.
+ */
+static void perform_tracking(int num_commits){
+  static const char *modes[] = {"declared", "vectored", "page_tracking"};
+  static range_t ranges[4096];
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  int mode, writes, i, j, offset;
+  double start;
+
+  printf("mode,writes_per_trans,trans_per_sec\n");
+  for (mode = 0; mode < 3; mode++) {
+    for (writes = 16; writes <= 4096; writes *= 4) {
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = RVM_DURABLE_FLUSH;
+      opts.page_tracking = mode == 2;
+
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+      rvm_destroy(rvm, "trackseg");
+      seg = (char *) rvm_map(rvm, "trackseg", SEG_SIZE);
+
+      start = now_sec();
+      for (i = 0; i < num_commits; i++) {
+        trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+        for (j = 0; j < writes; j++) {
+          /* Scattered 8 byte writes over the first 64 KB */
+          offset = ((i + j) * 7919 * 8) % (64 * 1024);
+          if (mode == 0)
+            rvm_about_to_modify(trans, seg, offset, 8);
+          ranges[j].offset = offset;
+          ranges[j].size = 8;
+        }
+        if (mode == 1)
+          rvm_about_to_modify_v(trans, seg, ranges, writes);
+        for (j = 0; j < writes; j++)
+          memset(seg + ranges[j].offset, j, 8);
+        rvm_commit_trans(trans);
+      }
+      printf("%s,%d,%.0f\n", modes[mode], writes, num_commits / (now_sec() - start));
+      fflush(stdout);
+
+      rvm_unmap(rvm, seg);
+      rvm_destroy(rvm, "trackseg");
+    }
+  }
+}
+
+/*
+ * Concurrent committers: each thread commits num_commits transactions
+ * to a segment of its own. Fsyncs are shared between threads, so the
+ * total rate should grow with the thread count.
+ */
+static void perform_threads(int num_commits){
+  static const char *names[] = {"default", "none", "flush", "fdatasync", "dsync"};
+  static const rvm_durability_t levels[] = {RVM_DURABLE_FLUSH, RVM_DURABLE_FDATASYNC};
+  committer_t c[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  rvm_options_t opts;
+  rvm_t rvm;
+  char segname[32];
+  int l, n, i;
+  double start, elapsed;
+
+  printf("durability,threads,commits,commits_per_sec\n");
+  for (l = 0; l < 2; l++) {
+    for (n = 1; n <= MAX_THREADS; n *= 2) {
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = levels[l];
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+
+      for (i = 0; i < n; i++) {
+        sprintf(segname, "threadseg%d", i);
+        rvm_destroy(rvm, segname);
+        c[i].rvm = rvm;
+        c[i].seg = (char *) rvm_map(rvm, segname, SEG_SIZE);
+        c[i].num_commits = num_commits;
+      }
+
+      start = now_sec();
+      for (i = 0; i < n; i++)
+        pthread_create(&threads[i], NULL, committer, &c[i]);
+      for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+      elapsed = now_sec() - start;
+
+      printf("%s,%d,%d,%.0f\n", names[levels[l]], n, n * num_commits,
+             n * num_commits / elapsed);
+      fflush(stdout);
+
+      for (i = 0; i < n; i++) {
+        rvm_unmap(rvm, c[i].seg);
+        sprintf(segname, "threadseg%d", i);
+        rvm_destroy(rvm, segname);
+      }
+    }
+  }
+}
+
+/*
+ * Sharded logs: MAX_THREADS committers on segments of their own with
+ * the segments hashed over a growing number of logs, then the time a
+ * fresh rvm takes to map one segment, which replays only its own log.
+ * On a single disk, fewer committers share each log's fdatasync, so
+ * synced commits may get slower as the logs multiply.
+ */
+static void perform_shards(int num_commits){
+  static const char *names[] = {"default", "none", "flush", "fdatasync", "dsync"};
+  static const rvm_durability_t levels[] = {RVM_DURABLE_FLUSH, RVM_DURABLE_FDATASYNC};
+  committer_t c[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  rvm_options_t opts;
+  rvm_t rvm;
+  char segname[32];
+  int l, shards, i;
+  double start, elapsed;
+
+  printf("durability,shards,threads,commits,commits_per_sec,map_sec\n");
+  for (l = 0; l < 2; l++) {
+    for (shards = 1; shards <= MAX_THREADS; shards *= 2) {
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = levels[l];
+      opts.log_shards = shards;
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+
+      for (i = 0; i < MAX_THREADS; i++) {
+        sprintf(segname, "shardseg%d", i);
+        rvm_destroy(rvm, segname);
+        c[i].rvm = rvm;
+        c[i].seg = (char *) rvm_map(rvm, segname, SEG_SIZE);
+        c[i].num_commits = num_commits;
+      }
+
+      start = now_sec();
+      for (i = 0; i < MAX_THREADS; i++)
+        pthread_create(&threads[i], NULL, committer, &c[i]);
+      for (i = 0; i < MAX_THREADS; i++)
+        pthread_join(threads[i], NULL);
+      elapsed = now_sec() - start;
+
+      for (i = 0; i < MAX_THREADS; i++)
+        rvm_unmap(rvm, c[i].seg);
+
+      /* As if restarting: the logs are still full */
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+      start = now_sec();
+      c[0].seg = (char *) rvm_map(rvm, "shardseg0", SEG_SIZE);
+
+      printf("%s,%d,%d,%d,%.0f,%.3f\n", names[levels[l]], shards, MAX_THREADS,
+             MAX_THREADS * num_commits, MAX_THREADS * num_commits / elapsed, now_sec() - start);
+      fflush(stdout);
+
+      rvm_unmap(rvm, c[0].seg);
+      for (i = 0; i < MAX_THREADS; i++) {
+        sprintf(segname, "shardseg%d", i);
+        rvm_destroy(rvm, segname);
+      }
+    }
+  }
+}
+
+/*
+ * Log replay: commits num_commits transactions to each of a number of
+ * segments, then truncates the log and reports the time spent scanning
+ * it and writing the segments back, for a range of worker counts.
+ */
+static void perform_recovery(int num_commits){
+  rvm_options_t opts;
+  rvm_replay_times_t times;
+  rvm_t rvm;
+  trans_t trans;
+  char *segs[RECOVERY_SEGS];
+  char segname[32];
+  int workers, i, s, offset;
+  double start;
+
+  printf("workers,segments,records,scan_sec,apply_sec,total_sec\n");
+  for (workers = 1; workers <= 8; workers *= 2) {
+    memset(&opts, 0, sizeof(opts));
+    opts.durability = RVM_DURABLE_FLUSH;
+    opts.recovery_threads = workers;
+    rvm = rvm_init_opts(PERFORM_DIR, &opts);
+
+    for (s = 0; s < RECOVERY_SEGS; s++) {
+      sprintf(segname, "recoveryseg%d", s);
+      rvm_destroy(rvm, segname);
+      segs[s] = (char *) rvm_map(rvm, segname, SEG_SIZE);
+    }
+
+    for (i = 0; i < num_commits; i++) {
+      for (s = 0; s < RECOVERY_SEGS; s++) {
+        offset = (i * 7919 * UPDATE_SIZE) % (SEG_SIZE - UPDATE_SIZE);
+        trans = rvm_begin_trans(rvm, 1, (void **) &segs[s]);
+        rvm_about_to_modify(trans, segs[s], offset, UPDATE_SIZE);
+        memset(segs[s] + offset, i & 0xff, UPDATE_SIZE);
+        rvm_commit_trans(trans);
+      }
+    }
+
+    start = now_sec();
+    rvm_truncate_log(rvm);
+    rvm_replay_times(rvm, &times);
+    printf("%d,%d,%ld,%.3f,%.3f,%.3f\n", workers, times.segments, times.records,
+           times.scan_sec, times.apply_sec, now_sec() - start);
+    fflush(stdout);
+
+    for (s = 0; s < RECOVERY_SEGS; s++) {
+      rvm_unmap(rvm, segs[s]);
+      sprintf(segname, "recoveryseg%d", s);
+      rvm_destroy(rvm, segname);
+    }
+  }
+}
+
+/*
+ * Checks a snapshot of seg holds its committed contents: taken while a
+ * transaction has written to the segment, it must leave those writes
+ * out, and neither that commit nor num_commits more may change it.
+ * Returns 1 if it does.
+ */
+static int snapshot_check(rvm_t rvm, char *seg, size_t size, int num_commits){
+  trans_t trans;
+  char *want;
+  const void *snap;
+  size_t offset;
+  int i, ok;
+
+  want = (char *) malloc(size);
+  memcpy(want, seg, size);
+
+  trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+  rvm_about_to_modify(trans, seg, 0, UPDATE_SIZE);
+  memset(seg, 0xee, UPDATE_SIZE);
+  rvm_about_to_modify(trans, seg, size / 2, UPDATE_SIZE);
+  memset(seg + size / 2, 0xee, UPDATE_SIZE);
+
+  snap = rvm_snapshot(rvm, seg);
+  if (snap == (const void *) -1) {
+    rvm_abort_trans(trans);
+    free(want);
+    return 0;
+  }
+  ok = memcmp(snap, want, size) == 0;
+
+  rvm_commit_trans(trans);
+  for (i = 0; i < num_commits; i++) {
+    offset = ((size_t) i * 7919 * 4096) % (size - UPDATE_SIZE);
+    trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+    rvm_about_to_modify(trans, seg, offset, UPDATE_SIZE);
+    memset(seg + offset, (i & 0x7f) + 2, UPDATE_SIZE);
+    rvm_commit_trans(trans);
+  }
+  ok = ok && memcmp(snap, want, size) == 0;
+
+  rvm_snapshot_release(rvm, snap);
+  free(want);
+
+  return ok;
+}
+
+/*
+ * Snapshots: time to take one of segments of growing size, set against
+ * copying the segment, and the commit rate while one is live, for
+ * malloc'ed and mmap'ed segments. Commits scatter over the segment, so
+ * each one first copies a page for the snapshot. Each size is also
+ * checked with snapshot_check.
+ */
+static void perform_snapshot(int num_commits){
+  static const char *modes[] = {"malloc", "mmap"};
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg, *copy;
+  const void *snap;
+  size_t size, offset;
+  int m, mb, live, i, ok;
+  double t, snap_sec, copy_sec, commit_rate[2];
+
+  printf("mode,segment_mb,snapshot_us,copy_us,commits_per_sec,commits_per_sec_snapshot,verified\n");
+  for (m = 0; m < 2; m++) {
+    for (mb = 1; mb <= 256; mb *= 4) {
+      size = (size_t) mb << 20;
+
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = RVM_DURABLE_FLUSH;
+      opts.mmap_segments = m;
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+      rvm_destroy(rvm, "snapseg");
+      seg = (char *) rvm_map(rvm, "snapseg", size);
+
+      trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+      rvm_about_to_modify(trans, seg, 0, size);
+      memset(seg, 1, size);
+      rvm_commit_trans(trans);
+
+      t = now_sec();
+      snap = rvm_snapshot(rvm, seg);
+      snap_sec = now_sec() - t;
+      rvm_snapshot_release(rvm, snap);
+
+      copy = (char *) malloc(size);
+      t = now_sec();
+      memcpy(copy, seg, size);
+      copy_sec = now_sec() - t;
+      free(copy);
+
+      for (live = 0; live < 2; live++) {
+        snap = live ? rvm_snapshot(rvm, seg) : NULL;
+        t = now_sec();
+        for (i = 0; i < num_commits; i++) {
+          offset = ((size_t) i * 7919 * 4096) % (size - UPDATE_SIZE);
+          trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+          rvm_about_to_modify(trans, seg, offset, UPDATE_SIZE);
+          memset(seg + offset, i & 0xff, UPDATE_SIZE);
+          rvm_commit_trans(trans);
+        }
+        commit_rate[live] = num_commits / (now_sec() - t);
+        if (snap != NULL)
+          rvm_snapshot_release(rvm, snap);
+      }
+
+      ok = snapshot_check(rvm, seg, size, num_commits);
+
+      printf("%s,%d,%.1f,%.1f,%.0f,%.0f,%s\n", modes[m], mb, snap_sec * 1e6, copy_sec * 1e6,
+             commit_rate[0], commit_rate[1], ok ? "yes" : "no");
+      fflush(stdout);
+
+      rvm_unmap(rvm, seg);
+      rvm_destroy(rvm, "snapseg");
+    }
+  }
+}
+
+/* One point of the benchmark sweep */
+typedef struct{
+  const char *dimension;  /*The one varied from the baseline*/
+  int segments;
+  long seg_kb;
+  int ranges;             /*Ranges declared per transaction*/
+  long range_bytes;
+  long rate;              /*Transactions started per second, 0 for flat out*/
+} sweep_cfg_t;
+
+typedef struct{
+  histogram_t begin, modify, commit, abort;
+  long committed_bytes;
+} sweep_stats_t;
+
+static long log_size(void){
+  struct stat st;
+
+  return stat(PERFORM_DIR "/redo.log", &st) == 0 ? (long) st.st_size : 0;
+}
+
+/*
+ * Runs num_commits transactions of the sweep point cfg on segments
+ * segs, each on one segment in turn, declaring cfg->ranges scattered
+ * ranges. Latencies go to stats.
+ */
+static void sweep_work(rvm_t rvm, char **segs, const sweep_cfg_t *cfg,
+                       int num_commits, sweep_stats_t *stats){
+  size_t seg_size = (size_t) cfg->seg_kb << 10;
+  size_t len = (size_t) cfg->range_bytes < seg_size ? (size_t) cfg->range_bytes : seg_size;
+  unsigned long rng = 12345;
+  trans_t trans;
+  size_t offset;
+  double start, t;
+  int i, r, s;
+
+  start = now_sec();
+  for (i = 0; i < num_commits; i++) {
+    /* Pace transactions to the offered rate */
+    if (cfg->rate > 0) {
+      while (now_sec() - start < (double) i / cfg->rate)
+        ;
+    }
+
+    s = i % cfg->segments;
+    t = now_sec();
+    trans = rvm_begin_trans(rvm, 1, (void **) &segs[s]);
+    hist_add(&(stats->begin), (now_sec() - t) * 1e9);
+
+    for (r = 0; r < cfg->ranges; r++) {
+      rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+      offset = (size_t) (rng >> 17) % (seg_size - len + 1);
+
+      t = now_sec();
+      rvm_about_to_modify(trans, segs[s], offset, len);
+      hist_add(&(stats->modify), (now_sec() - t) * 1e9);
+      memset(segs[s] + offset, i & 0xff, len);
+    }
+
+    t = now_sec();
+    if (i % SWEEP_ABORT_EVERY == SWEEP_ABORT_EVERY - 1) {
+      rvm_abort_trans(trans);
+      hist_add(&(stats->abort), (now_sec() - t) * 1e9);
+    } else {
+      rvm_commit_trans(trans);
+      hist_add(&(stats->commit), (now_sec() - t) * 1e9);
+      stats->committed_bytes += (long) (cfg->ranges * len);
+    }
+  }
+}
+
+static void sweep_map(rvm_t rvm, char **segs, const sweep_cfg_t *cfg, int fresh){
+  char segname[32];
+  int s;
+
+  for (s = 0; s < cfg->segments; s++) {
+    sprintf(segname, "sweepseg%d", s);
+    if (fresh)
+      rvm_destroy(rvm, segname);
+    segs[s] = (char *) rvm_map(rvm, segname, (size_t) cfg->seg_kb << 10);
+  }
+}
+
+static void sweep_unmap(rvm_t rvm, char **segs, const sweep_cfg_t *cfg, int destroy){
+  char segname[32];
+  int s;
+
+  for (s = 0; s < cfg->segments; s++) {
+    rvm_unmap(rvm, segs[s]);
+    sprintf(segname, "sweepseg%d", s);
+    if (destroy)
+      rvm_destroy(rvm, segname);
+  }
+}
+
+static void sweep_point(const sweep_cfg_t *cfg, int num_commits, long run){
+  rvm_options_t opts;
+  sweep_stats_t stats;
+  char *segs[SWEEP_MAX_SEGS];
+  rvm_t rvm;
+  long log_start, log_bytes, committed;
+  double start, elapsed, truncate_sec, recover_sec;
+
+  memset(&opts, 0, sizeof(opts));
+  memset(&stats, 0, sizeof(stats));
+  opts.durability = RVM_DURABLE_FLUSH;
+
+  rvm = rvm_init_opts(PERFORM_DIR, &opts);
+  sweep_map(rvm, segs, cfg, 1);
+  rvm_truncate_log(rvm);
+
+  /* Throughput, latencies and log volume, then truncating that log */
+  log_start = log_size();
+  start = now_sec();
+  sweep_work(rvm, segs, cfg, num_commits, &stats);
+  elapsed = now_sec() - start;
+  log_bytes = log_size() - log_start;
+  committed = stats.committed_bytes;
+
+  start = now_sec();
+  rvm_truncate_log(rvm);
+  truncate_sec = now_sec() - start;
+
+  /* The same again, recovered by a fresh rvm as after a restart */
+  sweep_work(rvm, segs, cfg, num_commits, &stats);
+  sweep_unmap(rvm, segs, cfg, 0);
+
+  start = now_sec();
+  rvm = rvm_init_opts(PERFORM_DIR, &opts);
+  sweep_map(rvm, segs, cfg, 0);
+  recover_sec = now_sec() - start;
+
+  printf("%ld,%s,%d,%ld,%d,%ld,%ld,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.3f,%.3f\n",
+         run, cfg->dimension, cfg->segments, cfg->seg_kb, cfg->ranges, cfg->range_bytes, cfg->rate,
+         num_commits / elapsed,
+         hist_percentile(&stats.begin, 0.5), hist_percentile(&stats.begin, 0.99),
+         hist_percentile(&stats.modify, 0.5), hist_percentile(&stats.modify, 0.99),
+         hist_percentile(&stats.commit, 0.5), hist_percentile(&stats.commit, 0.99),
+         hist_percentile(&stats.abort, 0.5), hist_percentile(&stats.abort, 0.99),
+         committed > 0 ? (double) log_bytes / committed : 0.0,
+         truncate_sec * 1e3, recover_sec * 1e3);
+  fflush(stdout);
+
+  sweep_unmap(rvm, segs, cfg, 1);
+}
+
+/*
+ * Benchmark sweep: varies one dimension at a time from a baseline of
+ * one 1 MB segment and four 64 byte ranges per transaction, run flat
+ * out. Latency columns are histogram bucket upper bounds in
+ * microseconds, within 1/16 of the true percentile. log_per_byte is
+ * log bytes written per byte committed. Every row carries the start
+ * time of the run, so the output of repeated runs can be appended to
+ * one file and plotted over time.
+ */
+static void perform_sweep(int num_commits){
+  static const sweep_cfg_t points[] = {
+    {"baseline",    1,     1024, 4,    64,      0},
+    {"segments",    4,     1024, 4,    64,      0},
+    {"segments",    16,    1024, 4,    64,      0},
+    {"seg_kb",      1,     64,   4,    64,      0},
+    {"seg_kb",      1,     16384, 4,   64,      0},
+    {"ranges",      1,     1024, 1,    64,      0},
+    {"ranges",      1,     1024, 16,   64,      0},
+    {"ranges",      1,     1024, 256,  64,      0},
+    {"range_bytes", 1,     1024, 4,    8,       0},
+    {"range_bytes", 1,     1024, 4,    1024,    0},
+    {"range_bytes", 1,     1024, 4,    16384,   0},
+    {"rate",        1,     1024, 4,    64,      1000},
+    {"rate",        1,     1024, 4,    64,      10000},
+  };
+  long run = (long) time(NULL);
+  size_t i;
+
+  printf("run,dimension,segments,seg_kb,ranges,range_bytes,rate,commits_per_sec,"
+         "begin_p50_us,begin_p99_us,modify_p50_us,modify_p99_us,"
+         "commit_p50_us,commit_p99_us,abort_p50_us,abort_p99_us,"
+         "log_per_byte,truncate_ms,recover_ms\n");
+  for (i = 0; i < sizeof(points) / sizeof(points[0]); i++)
+    sweep_point(&points[i], num_commits, run);
+}
+
+/* Range every transaction of the delta experiment declares */
+#define DELTA_RANGE  (64 * 1024)
+
+/*
+ * Declares a 64 KB range per transaction but changes only a few
+ * scattered bytes of it, or fills it with compressible text, with and
+ * without record compression. Shows what diffing against the undo
+ * image and compressing leave of the declared bytes.
+ */
+static void perform_delta(int num_commits){
+  static const int edits[] = {1, 16, 256, -1};  /* -1 rewrites the whole range */
+  rvm_options_t opts;
+  rvm_redo_stats_t stats;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  int compress, e, i, k;
+  double start, elapsed;
+
+  printf("edits,compress,commits_per_sec,declared_bytes,changed_bytes,logged_bytes\n");
+  for (compress = 0; compress <= 1; compress++) {
+    for (e = 0; e < (int) (sizeof(edits) / sizeof(edits[0])); e++) {
+      memset(&opts, 0, sizeof(opts));
+      opts.durability = RVM_DURABLE_FLUSH;
+      opts.log_compress = compress ? 512 : 0;
+      rvm = rvm_init_opts(PERFORM_DIR, &opts);
+      rvm_destroy(rvm, "deltaseg");
+      seg = (char *) rvm_map(rvm, "deltaseg", SEG_SIZE);
+
+      start = now_sec();
+      for (i = 0; i < num_commits; i++) {
+        trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+        rvm_about_to_modify(trans, seg, 0, DELTA_RANGE);
+        if (edits[e] < 0) {
+          for (k = 0; k < DELTA_RANGE; k++)
+            seg[k] = "commit log "[(i + k) % 11];
+        } else {
+          for (k = 0; k < edits[e]; k++)
+            seg[(k * 7919 + i * 131) % DELTA_RANGE]++;
+        }
+        rvm_commit_trans(trans);
+      }
+      elapsed = now_sec() - start;
+
+      rvm_redo_stats(rvm, &stats);
+      printf("%d,%d,%.0f,%llu,%llu,%llu\n", edits[e], compress, num_commits / elapsed,
+             (unsigned long long) stats.declared_bytes, (unsigned long long) stats.changed_bytes,
+             (unsigned long long) stats.logged_bytes);
+      fflush(stdout);
+
+      rvm_truncate_log(rvm);
+      rvm_unmap(rvm, seg);
+      rvm_destroy(rvm, "deltaseg");
+    }
+  }
+}
+
+/* Segment and update size of the lazy recovery experiment */
+#define LAZY_SEG_SIZE (64 << 20)
+#define LAZY_UPDATE   (16 << 10)
+
+/*
+ * Lazy recovery: leaves num_commits scattered updates of a large
+ * segment in the log, then times mapping it in a fresh rvm with and
+ * without lazy_recovery, the first access, and touching every page.
+ */
+static void perform_lazy(int num_commits){
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  int lazy, i, offset;
+  long pages;
+  double start, mapped, first;
+  volatile char sink;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.durability = RVM_DURABLE_FLUSH;
+  opts.mmap_segments = 1;
+  rvm = rvm_init_opts(PERFORM_DIR, &opts);
+  rvm_destroy(rvm, "lazyseg");
+  seg = (char *) rvm_map(rvm, "lazyseg", LAZY_SEG_SIZE);
+  for (i = 0; i < num_commits; i++) {
+    offset = (int) (((long) i * 7919 * LAZY_UPDATE) % (LAZY_SEG_SIZE - LAZY_UPDATE));
+    trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+    rvm_about_to_modify(trans, seg, offset, LAZY_UPDATE);
+    memset(seg + offset, i & 0xff, LAZY_UPDATE);
+    rvm_commit_trans(trans);
+  }
+  rvm_unmap(rvm, seg);
+
+  /* Lazy first: the eager map empties the log */
+  printf("lazy,log_bytes,map_sec,first_access_sec,all_pages_sec\n");
+  for (lazy = 1; lazy >= 0; lazy--) {
+    opts.lazy_recovery = lazy;
+    rvm = rvm_init_opts(PERFORM_DIR, &opts);
+
+    start = now_sec();
+    seg = (char *) rvm_map(rvm, "lazyseg", LAZY_SEG_SIZE);
+    mapped = now_sec();
+    sink = seg[LAZY_SEG_SIZE / 2];
+    first = now_sec();
+    for (pages = 0; pages < LAZY_SEG_SIZE / 4096; pages++)
+      sink = seg[pages * 4096];
+    (void) sink;
+
+    printf("%d,%ld,%.4f,%.4f,%.4f\n", lazy, log_size(), mapped - start, first - mapped,
+           now_sec() - start);
+    fflush(stdout);
+
+    rvm_unmap(rvm, seg);
+  }
+  rvm_destroy(rvm, "lazyseg");
+}
+
+/* Events the trace experiment keeps, and how much slower than average a commit must be to dump them */
+#define TRACE_EVENTS  (64)
+#define TRACE_SPIKE   (20)
+
+/*
+ * Commits num_commits small transactions, aborting every tenth, with
+ * tracing off and on, and prints what rvm_stats counted for each run.
+ * With tracing on, the events leading up to the first commit that
+ * takes TRACE_SPIKE times the average so far go to stderr.
+ */
+static void perform_trace(int num_commits){
+  rvm_options_t opts;
+  rvm_stats_t stats;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  int trace, i, offset, dumped;
+  double start, elapsed, t, lat, total;
+
+  printf("trace,commits_per_sec,begins,commits,aborts,modify_calls,undo_bytes,logged_bytes,"
+         "log_writes,syncs,commit_us_avg,log_write_us_avg,log_sync_us_avg\n");
+  for (trace = 0; trace <= 1; trace++) {
+    memset(&opts, 0, sizeof(opts));
+    opts.trace_events = trace ? TRACE_EVENTS : 0;
+    rvm = rvm_init_opts(PERFORM_DIR, &opts);
+    rvm_destroy(rvm, "traceseg");
+    seg = (char *) rvm_map(rvm, "traceseg", SEG_SIZE);
+
+    dumped = 0;
+    total = 0;
+    start = now_sec();
+    for (i = 0; i < num_commits; i++) {
+      offset = (i * UPDATE_SIZE) % (SEG_SIZE - UPDATE_SIZE);
+
+      trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+      rvm_about_to_modify(trans, seg, offset, UPDATE_SIZE);
+      memset(seg + offset, i & 0xff, UPDATE_SIZE);
+      if (i % SWEEP_ABORT_EVERY == SWEEP_ABORT_EVERY - 1) {
+        rvm_abort_trans(trans);
+        continue;
+      }
+
+      t = now_sec();
+      rvm_commit_trans(trans);
+      lat = now_sec() - t;
+      if (trace && !dumped && i >= 100 && lat > TRACE_SPIKE * total / i) {
+        fprintf(stderr, "Commit %d took %.3f us, %.0f times the average:\n",
+                i, lat * 1e6, lat * i / total);
+        rvm_dump_trace(rvm, stderr);
+        dumped = 1;
+      }
+      total += lat;
+    }
+    elapsed = now_sec() - start;
+
+    rvm_stats(rvm, &stats);
+    printf("%d,%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f\n",
+           trace, num_commits / elapsed,
+           (unsigned long long) stats.begins, (unsigned long long) stats.commits,
+           (unsigned long long) stats.aborts, (unsigned long long) stats.modify_calls,
+           (unsigned long long) stats.undo_bytes, (unsigned long long) stats.logged_bytes,
+           (unsigned long long) stats.log_writes, (unsigned long long) stats.syncs,
+           stats.commits ? stats.commit_ns / 1e3 / stats.commits : 0,
+           stats.log_writes ? stats.log_write_ns / 1e3 / stats.log_writes : 0,
+           stats.syncs ? stats.log_sync_ns / 1e3 / stats.syncs : 0);
+    fflush(stdout);
+
+    rvm_unmap(rvm, seg);
+    rvm_destroy(rvm, "traceseg");
+  }
+}
+
+/* Size of the hot region the compaction experiment commits over and over */
+#define COMPACT_HOT_SIZE (4096)
+
+/* Disk space the log takes up, which leaves out truncated holes */
+static long log_disk(void){
+  struct stat st;
+
+  return stat(PERFORM_DIR "/redo.log", &st) == 0 ? (long) st.st_blocks * 512 : 0;
+}
+
+/*
+ * Commits the same 4 KB region num_commits times, then truncates the
+ * log, once as it is and once compacted first. Compaction should
+ * leave a single 4 KB record for truncation to read and apply.
+ */
+static void perform_compact(int num_commits){
+  rvm_options_t opts;
+  rvm_replay_times_t times;
+  rvm_t rvm;
+  trans_t trans;
+  char *seg;
+  long before;
+  int compact, i;
+  double compact_sec, start;
+
+  printf("compact,commits,log_bytes,compacted_bytes,compact_sec,records,truncate_sec\n");
+  for (compact = 0; compact <= 1; compact++) {
+    memset(&opts, 0, sizeof(opts));
+    opts.durability = RVM_DURABLE_FLUSH;
+    rvm = rvm_init_opts(PERFORM_DIR, &opts);
+    rvm_destroy(rvm, "compactseg");
+    seg = (char *) rvm_map(rvm, "compactseg", SEG_SIZE);
+
+    for (i = 0; i < num_commits; i++) {
+      trans = rvm_begin_trans(rvm, 1, (void **) &seg);
+      rvm_about_to_modify(trans, seg, 0, COMPACT_HOT_SIZE);
+      memset(seg, i & 0xff, COMPACT_HOT_SIZE);
+      rvm_commit_trans(trans);
+    }
+
+    before = log_disk();
+    compact_sec = 0;
+    if (compact) {
+      start = now_sec();
+      rvm_compact_log(rvm);
+      compact_sec = now_sec() - start;
+    }
+
+    printf("%d,%d,%ld,%ld,%.3f,", compact, num_commits, before, log_disk(), compact_sec);
+
+    start = now_sec();
+    rvm_truncate_log(rvm);
+    rvm_replay_times(rvm, &times);
+    printf("%ld,%.3f\n", times.records, now_sec() - start);
+    fflush(stdout);
+
+    rvm_unmap(rvm, seg);
+    rvm_destroy(rvm, "compactseg");
+  }
+}
+
+/* Where slot i of the crash experiment lives, spread over both segments and many pages */
+static size_t crash_slot(int i){
+  return (size_t) i * (SEG_SIZE / CRASH_SLOTS) + (size_t) i * 8;
+}
+
+/* Commits transactions setting every slot to seq, seq + 1, ... until killed */
+static void crash_writer(uint64_t seq){
+  rvm_options_t opts;
+  rvm_t rvm;
+  trans_t trans;
+  char *segs[2];
+  int i;
+
+  memset(&opts, 0, sizeof(opts));
+  opts.durability = RVM_DURABLE_FLUSH;
+  rvm = rvm_init_opts(PERFORM_DIR, &opts);
+  segs[0] = (char *) rvm_map(rvm, "crashseg0", SEG_SIZE);
+  segs[1] = (char *) rvm_map(rvm, "crashseg1", SEG_SIZE);
+
+  for (;; seq++) {
+    trans = rvm_begin_trans(rvm, 2, (void **) segs);
+    for (i = 0; i < CRASH_SLOTS; i++) {
+      rvm_about_to_modify(trans, segs[i % 2], crash_slot(i), sizeof(seq));
+      memcpy(segs[i % 2] + crash_slot(i), &seq, sizeof(seq));
+    }
+    rvm_commit_trans(trans);
+  }
+}
+
+/*
+ * Tears the tail of the log the way a crash mid-write would: cuts it
+ * at a random point, or corrupts one of its last bytes. Returns what
+ * was done.
+ */
+static const char *crash_damage(unsigned *rng){
+  char path[256];
+  struct stat st;
+  off_t first, at;
+  char byte;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/redo.log", PERFORM_DIR);
+  first = (off_t) rvm_log_first_record();
+  if ((fd = open(path, O_RDWR)) < 0 || fstat(fd, &st) != 0 || st.st_size <= first) {
+    if (fd >= 0)
+      close(fd);
+    return "none";
+  }
+
+  switch (rand_r(rng) % 3) {
+  case 0:
+    at = first + rand_r(rng) % (st.st_size - first);
+    if (ftruncate(fd, at) != 0)
+      at = -1;
+    close(fd);
+    return at < 0 ? "none" : "cut";
+  case 1:
+    at = st.st_size - 1 - rand_r(rng) % (st.st_size - first < 4096 ? st.st_size - first : 4096);
+    if (pread(fd, &byte, 1, at) == 1) {
+      byte ^= (char) (1 << (rand_r(rng) % 8));
+      if (pwrite(fd, &byte, 1, at) != 1)
+        at = -1;
+    }
+    close(fd);
+    return at < 0 ? "none" : "flip";
+  default:
+    close(fd);
+    return "none";
+  }
+}
+
+/*
+ * Crash injection: a child commits transactions that set slots in two
+ * segments to the same sequence number and is SIGKILLed at a random
+ * moment. The log tail may then be cut or corrupted. Recovery must
+ * leave every slot holding the same number: no transaction is ever
+ * half applied.
+ */
+static void perform_crash(int rounds){
+  rvm_t rvm;
+  char *segs[2];
+  uint64_t seq, v;
+  unsigned rng = 42;
+  const char *damage;
+  pid_t pid;
+  int round, i, consistent, failures = 0;
+
+  rvm = rvm_init_opts(PERFORM_DIR, NULL);
+  rvm_destroy(rvm, "crashseg0");
+  rvm_destroy(rvm, "crashseg1");
+  seq = 0;
+
+  printf("round,damage,recovered_seq,consistent\n");
+  for (round = 0; round < rounds; round++) {
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+      crash_writer(seq + 1);
+      _exit(0);
+    }
+    usleep(1000 + rand_r(&rng) % 50000);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    damage = crash_damage(&rng);
+
+    /* Recover as a fresh process would and check the slots agree */
+    rvm = rvm_init_opts(PERFORM_DIR, NULL);
+    segs[0] = (char *) rvm_map(rvm, "crashseg0", SEG_SIZE);
+    segs[1] = (char *) rvm_map(rvm, "crashseg1", SEG_SIZE);
+    memcpy(&seq, segs[0] + crash_slot(0), sizeof(seq));
+    consistent = 1;
+    for (i = 1; i < CRASH_SLOTS; i++) {
+      memcpy(&v, segs[i % 2] + crash_slot(i), sizeof(v));
+      if (v != seq)
+        consistent = 0;
+    }
+    rvm_unmap(rvm, segs[0]);
+    rvm_unmap(rvm, segs[1]);
+
+    failures += !consistent;
+    printf("%d,%s,%llu,%s\n", round, damage, (unsigned long long) seq,
+           consistent ? "yes" : "no");
+  }
+
+  fprintf(stderr, "%d of %d rounds recovered inconsistently\n", failures, rounds);
+}
+
+int main(int argc, char *argv[]){
+  int num_commits;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: rvm_perform [group|durability|large|tracking|threads|recovery|snapshot|sweep|compact|delta|shards|lazy|trace|crash] [NUM_COMMITS|ROUNDS]\n");
+    exit(0);
+  }
+
+  num_commits = 2000;
+  if (argc > 2)
+    num_commits = strtol(argv[2], NULL, 10);
+
+  if (strcmp(argv[1], "group") == 0)
+    perform_group(num_commits);
+  else if (strcmp(argv[1], "durability") == 0)
+    perform_durability(num_commits);
+  else if (strcmp(argv[1], "large") == 0)
+    perform_large(num_commits);
+  else if (strcmp(argv[1], "tracking") == 0)
+    perform_tracking(num_commits);
+  else if (strcmp(argv[1], "threads") == 0)
+    perform_threads(num_commits);
+  else if (strcmp(argv[1], "recovery") == 0)
+    perform_recovery(num_commits);
+  else if (strcmp(argv[1], "snapshot") == 0)
+    perform_snapshot(num_commits);
+  else if (strcmp(argv[1], "sweep") == 0)
+    perform_sweep(num_commits);
+  else if (strcmp(argv[1], "compact") == 0)
+    perform_compact(num_commits);
+  else if (strcmp(argv[1], "delta") == 0)
+    perform_delta(num_commits);
+  else if (strcmp(argv[1], "shards") == 0)
+    perform_shards(num_commits);
+  else if (strcmp(argv[1], "lazy") == 0)
+    perform_lazy(num_commits);
+  else if (strcmp(argv[1], "trace") == 0)
+    perform_trace(num_commits);
+  else if (strcmp(argv[1], "crash") == 0)
+    perform_crash(num_commits);
+  else
+    fprintf(stderr, "Unknown experiment %s\n", argv[1]);
+
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include "rvm_plan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rangeset.h"
+
+#define PLAN_ARENA_CHUNK (1 << 20)
+
+static int plan_keyeq(linprobst_key a, linprobst_key b){
+  return strcmp((char *) a, (char *) b) == 0;
+}
+
+static void *plan_realloc(void *p, size_t size){
+  if ((p = realloc(p, size)) == NULL) {
+    fprintf(stderr, "Error: out of memory in rvm_plan.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void rvm_plan_init(rvm_plan_t *plan, size_t maxbytes){
+  arena_init(&(plan->arena), PLAN_ARENA_CHUNK);
+  linprobst_init(&(plan->byname), linprobst_strhash, plan_keyeq);
+  plan->segs = NULL;
+  plan->nsegs = 0;
+  plan->capsegs = 0;
+  plan->bytes = 0;
+  plan->maxbytes = maxbytes;
+  plan->full = 0;
+}
+
+static rvm_plan_seg_t *plan_seg(rvm_plan_t *plan, const char *segname){
+  rvm_plan_seg_t *ps;
+
+  ps = (rvm_plan_seg_t *) linprobst_get(&(plan->byname), (linprobst_key) segname);
+  if (ps != NULL)
+    return ps;
+
+  ps = (rvm_plan_seg_t *) arena_alloc(&(plan->arena), sizeof(rvm_plan_seg_t));
+  ps->segname = (char *) arena_alloc(&(plan->arena), strlen(segname) + 1);
+  strcpy(ps->segname, segname);
+  ps->writes = NULL;
+  ps->N = 0;
+  ps->cap = 0;
+
+  if (plan->nsegs == plan->capsegs) {
+    plan->capsegs = plan->capsegs ? 2 * plan->capsegs : 16;
+    plan->segs = plan_realloc(plan->segs, plan->capsegs * sizeof(rvm_plan_seg_t *));
+  }
+  plan->segs[plan->nsegs++] = ps;
+  linprobst_put(&(plan->byname), (linprobst_key) ps->segname, (linprobst_value) ps);
+
+  return ps;
+}
+
+int rvm_plan_add(void *arg, const char *segname,
+                 uint64_t offset, const void *data, uint64_t length){
+  rvm_plan_t *plan = (rvm_plan_t *) arg;
+  rvm_plan_seg_t *ps;
+  rvm_plan_write_t *w;
+  char *copy;
+
+  ps = plan_seg(plan, segname);
+  if (ps->N == ps->cap) {
+    ps->cap = ps->cap ? 2 * ps->cap : 16;
+    ps->writes = plan_realloc(ps->writes, ps->cap * sizeof(rvm_plan_write_t));
+  }
+
+  /* The replay buffer is reused, so the data has to be copied out */
+  copy = (char *) arena_alloc(&(plan->arena), (size_t) length);
+  memcpy(copy, data, (size_t) length);
+
+  w = &(ps->writes[ps->N++]);
+  w->offset = offset;
+  w->length = length;
+  w->data = copy;
+
+  plan->bytes += (size_t) length;
+  if (plan->maxbytes > 0 && plan->bytes >= plan->maxbytes) {
+    plan->full = 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+typedef struct resolve_ctx_t{
+  const rvm_plan_write_t *w;  /*Write being placed*/
+  rvm_plan_write_t *out;
+  int N;
+  int cap;
+} resolve_ctx_t;
+
+/* Keeps the part of ctx->w that no later write covers */
+static void resolve_gap(void *arg, size_t offset, size_t size){
+  resolve_ctx_t *ctx = (resolve_ctx_t *) arg;
+  rvm_plan_write_t *o;
+
+  if (ctx->N == ctx->cap) {
+    ctx->cap = ctx->cap ? 2 * ctx->cap : 16;
+    ctx->out = plan_realloc(ctx->out, ctx->cap * sizeof(rvm_plan_write_t));
+  }
+
+  o = &(ctx->out[ctx->N++]);
+  o->offset = (uint64_t) offset;
+  o->length = (uint64_t) size;
+  o->data = ctx->w->data + ((uint64_t) offset - ctx->w->offset);
+}
+
+static int write_cmp(const void *a, const void *b){
+  const rvm_plan_write_t *x = (const rvm_plan_write_t *) a;
+  const rvm_plan_write_t *y = (const rvm_plan_write_t *) b;
+
+  return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+void rvm_plan_resolve(rvm_plan_t *plan){
+  rvm_plan_seg_t *ps;
+  resolve_ctx_t ctx;
+  rangeset_t covered;
+  int i, j;
+
+  rangeset_init(&covered);
+  for (i = 0; i < plan->nsegs; i++) {
+    ps = plan->segs[i];
+    if (ps->N < 2)
+      continue;
+
+    /*
+     * Walk the writes newest first. Whatever a write adds to the
+     * covered set is not overwritten later, so that part survives.
+     */
+    ctx.out = NULL;
+    ctx.N = 0;
+    ctx.cap = 0;
+    rangeset_clear(&covered);
+    for (j = ps->N - 1; j >= 0; j--) {
+      ctx.w = &(ps->writes[j]);
+      rangeset_add(&covered, (size_t) ctx.w->offset, (size_t) ctx.w->length, resolve_gap, &ctx);
+    }
+
+    qsort(ctx.out, ctx.N, sizeof(rvm_plan_write_t), write_cmp);
+
+    free(ps->writes);
+    ps->writes = ctx.out;
+    ps->N = ctx.N;
+    ps->cap = ctx.cap;
+  }
+  rangeset_destroy(&covered);
+}
+
+void rvm_plan_reset(rvm_plan_t *plan){
+  int i;
+
+  for (i = 0; i < plan->nsegs; i++)
+    free(plan->segs[i]->writes);
+
+  /* Names live in the arena, so the table has to go before it is reset */
+  linprobst_destroy(&(plan->byname));
+  linprobst_init(&(plan->byname), linprobst_strhash, plan_keyeq);
+  arena_reset(&(plan->arena));
+
+  plan->nsegs = 0;
+  plan->bytes = 0;
+  plan->full = 0;
+}
+
+void rvm_plan_destroy(rvm_plan_t *plan){
+  rvm_plan_reset(plan);
+  linprobst_destroy(&(plan->byname));
+  arena_destroy(&(plan->arena));
+  free(plan->segs);
+}
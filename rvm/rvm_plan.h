@@ -0,0 +1,62 @@
+/*
+ * Write-back plan for replaying the redo log.
+ *
+ * Records are gathered from the log grouped by segment. Resolving the
+ * plan drops every byte that a later record overwrites and sorts what
+ * is left by offset, so each segment can be written back front to back
+ * with a handful of large writes.
+ */
+
+#ifndef RVM_PLAN_H
+#define RVM_PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "linprobst.h"
+
+typedef struct rvm_plan_write_t{
+  uint64_t offset;
+  uint64_t length;
+  const char *data;
+} rvm_plan_write_t;
+
+typedef struct rvm_plan_seg_t{
+  char *segname;
+  rvm_plan_write_t *writes;  /*Log order while gathering; disjoint and sorted once resolved*/
+  int N;
+  int cap;
+} rvm_plan_seg_t;
+
+typedef struct rvm_plan_t{
+  arena_t arena;            /*Copies of names and record data*/
+  linprobst_t byname;       /*Segment name -> rvm_plan_seg_t*/
+  rvm_plan_seg_t **segs;    /*In order of first appearance*/
+  int nsegs;
+  int capsegs;
+  size_t bytes;             /*Record data gathered so far*/
+  size_t maxbytes;
+  int full;                 /*Set once gathering stopped at maxbytes*/
+} rvm_plan_t;
+
+/* Initializes an empty plan that holds about maxbytes of record data */
+void rvm_plan_init(rvm_plan_t *plan, size_t maxbytes);
+
+/*
+ * Adds one record to the plan; an rvm_log_apply_fn. Stops the replay
+ * once the plan is full, setting plan->full.
+ */
+int rvm_plan_add(void *arg, const char *segname,
+                 uint64_t offset, const void *data, uint64_t length);
+
+/* Collapses overlapping writes, last one wins, and sorts each segment */
+void rvm_plan_resolve(rvm_plan_t *plan);
+
+/* Empties the plan, keeping its memory for the next batch */
+void rvm_plan_reset(rvm_plan_t *plan);
+
+/* Frees memory associated with plan */
+void rvm_plan_destroy(rvm_plan_t *plan);
+
+#endif
@@ -0,0 +1,109 @@
+#include "rvm_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint32_t next_thread = 0;
+static __thread uint32_t this_thread = 0;
+
+void rvm_trace_init(rvm_trace_t *trace, size_t events){
+  size_t n;
+
+  trace->ring = NULL;
+  trace->mask = 0;
+  trace->head = 0;
+  if (events == 0)
+    return;
+
+  for (n = 1; n < events; n <<= 1);
+  if ((trace->ring = calloc(n, sizeof(rvm_trace_event_t))) == NULL) {
+    fprintf(stderr, "Error: out of memory in rvm_trace.\n");
+    exit(EXIT_FAILURE);
+  }
+  trace->mask = n - 1;
+}
+
+uint64_t rvm_trace_now(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void rvm_trace_add(rvm_trace_t *trace, uint32_t type, uint64_t start_ns, uint64_t arg){
+  rvm_trace_event_t *e;
+  uint64_t idx, now;
+
+  if (trace->ring == NULL)
+    return;
+
+  if (this_thread == 0)
+    this_thread = __sync_add_and_fetch(&next_thread, 1);
+
+  now = rvm_trace_now();
+  idx = __sync_fetch_and_add(&(trace->head), 1);
+  e = &(trace->ring[idx & trace->mask]);
+
+  /* Readers see seq 0, or a seq that changed, while the slot is in flux */
+  e->seq = 0;
+  __sync_synchronize();
+  e->start_ns = start_ns;
+  e->dur_ns = now > start_ns ? now - start_ns : 0;
+  e->arg = arg;
+  e->type = type;
+  e->thread = this_thread;
+  __sync_synchronize();
+  e->seq = idx + 1;
+}
+
+size_t rvm_trace_read(rvm_trace_t *trace, rvm_trace_event_t *out, size_t max){
+  rvm_trace_event_t *e;
+  uint64_t head, idx, first, seq;
+  size_t n = 0;
+
+  if (trace->ring == NULL || max == 0)
+    return 0;
+
+  head = __sync_fetch_and_add(&(trace->head), 0);
+  first = head > trace->mask + 1 ? head - (trace->mask + 1) : 0;
+  if (head - first > max)
+    first = head - max;
+
+  for (idx = first; idx < head; idx++) {
+    e = &(trace->ring[idx & trace->mask]);
+    seq = *(volatile uint64_t *) &(e->seq);
+    if (seq != idx + 1)
+      continue;
+    __sync_synchronize();
+    out[n] = *e;
+    __sync_synchronize();
+    if (*(volatile uint64_t *) &(e->seq) != seq)
+      continue;
+    out[n].seq = seq;
+    n++;
+  }
+
+  return n;
+}
+
+const char *rvm_trace_name(uint32_t type){
+  switch (type) {
+  case RVM_TRACE_BEGIN:       return "begin";
+  case RVM_TRACE_COMMIT:      return "commit";
+  case RVM_TRACE_ABORT:       return "abort";
+  case RVM_TRACE_LOG_WRITE:   return "log_write";
+  case RVM_TRACE_LOG_SYNC:    return "log_sync";
+  case RVM_TRACE_GROUP_FLUSH: return "group_flush";
+  case RVM_TRACE_TRUNCATE:    return "truncate";
+  case RVM_TRACE_MAP:         return "map";
+  case RVM_TRACE_LAZY_SCAN:   return "lazy_scan";
+  }
+  return "unknown";
+}
+
+void rvm_trace_destroy(rvm_trace_t *trace){
+  free(trace->ring);
+  trace->ring = NULL;
+  trace->mask = 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Ring of recent rvm events, for looking back at what led up to a
+ * latency spike.
+ *
+ * Writers claim a slot with one atomic add and never block; once the
+ * ring is full the oldest events are overwritten. Each slot carries
+ * the sequence number of its event, set last, so readers can skip
+ * events that were being written or overwritten while they looked.
+ */
+
+#ifndef RVM_TRACE_H
+#define RVM_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* rvm_trace_event_t types */
+#define RVM_TRACE_BEGIN       (1)  /* rvm_begin_trans; arg is the number of segments */
+#define RVM_TRACE_COMMIT      (2)  /* rvm_commit_trans; arg is the bytes logged */
+#define RVM_TRACE_ABORT       (3)  /* rvm_abort_trans; arg is the undo records restored */
+#define RVM_TRACE_LOG_WRITE   (4)  /* A log append, until written; arg is the bytes */
+#define RVM_TRACE_LOG_SYNC    (5)  /* An fdatasync of a log; arg is the shard */
+#define RVM_TRACE_GROUP_FLUSH (6)  /* A group commit batch; arg is the commits in it */
+#define RVM_TRACE_TRUNCATE    (7)  /* A truncation pass; arg is the records applied */
+#define RVM_TRACE_MAP         (8)  /* rvm_map; arg is 1 if recovery was left for first access */
+#define RVM_TRACE_LAZY_SCAN   (9)  /* Gathering a lazily mapped segment's records; arg is their bytes */
+
+typedef struct rvm_trace_event_t{
+  uint64_t seq;       /*Position in the trace, from 1; 0 while the slot is being written*/
+  uint64_t start_ns;  /*CLOCK_MONOTONIC time the event started*/
+  uint64_t dur_ns;    /*How long it took*/
+  uint64_t arg;       /*Depends on type, see above*/
+  uint32_t type;
+  uint32_t thread;    /*Small number told apart per thread*/
+} rvm_trace_event_t;
+
+typedef struct rvm_trace_t{
+  rvm_trace_event_t *ring;  /*NULL when tracing is off*/
+  uint64_t mask;
+  uint64_t head;            /*Events ever added*/
+} rvm_trace_t;
+
+/*
+ * Sets up a ring for the most recent events, rounded up to a power of
+ * two. With events 0 tracing stays off and adding is a no-op.
+ */
+void rvm_trace_init(rvm_trace_t *trace, size_t events);
+
+/* Current CLOCK_MONOTONIC time in nanoseconds */
+uint64_t rvm_trace_now(void);
+
+/* Records an event that started at start_ns and has just ended */
+void rvm_trace_add(rvm_trace_t *trace, uint32_t type, uint64_t start_ns, uint64_t arg);
+
+/*
+ * Copies up to max of the most recent events into out, oldest first.
+ * Returns the number copied.
+ */
+size_t rvm_trace_read(rvm_trace_t *trace, rvm_trace_event_t *out, size_t max);
+
+/* Name of an event type, for dumps */
+const char *rvm_trace_name(uint32_t type);
+
+/* Frees memory associated with trace */
+void rvm_trace_destroy(rvm_trace_t *trace);
+
+#endif